@@ -0,0 +1,572 @@
+// Arrow IPC files of keys
+// A file is the magic "ARROW1\0\0", the schema message, the record batch
+// messages with their bodies, the footer flatbuffer, its length and
+// "ARROW1". The footer lists the schema and where each record batch is.
+// Table and field ids below follow Schema.fbs, Message.fbs and File.fbs.
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <fcntl.h>
+#include <map>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "arrow_file.h"
+
+namespace bitonic {
+
+static const char ARROW_MAGIC[] = "ARROW1";
+static const uint32_t CONTINUATION = 0xffffffff;
+static const int16_t METADATA_V5 = 4;
+
+enum {
+    HEADER_SCHEMA = 1,
+    HEADER_RECORD_BATCH = 3,
+};
+
+enum {
+    TYPE_NULL = 1,
+    TYPE_INT = 2,
+    TYPE_FLOATING_POINT = 3,
+    TYPE_BINARY = 4,
+    TYPE_UTF8 = 5,
+    TYPE_BOOL = 6,
+    TYPE_DECIMAL = 7,
+    TYPE_DATE = 8,
+    TYPE_TIME = 9,
+    TYPE_TIMESTAMP = 10,
+    TYPE_INTERVAL = 11,
+    TYPE_LIST = 12,
+    TYPE_STRUCT = 13,
+    TYPE_FIXED_SIZE_BINARY = 15,
+    TYPE_FIXED_SIZE_LIST = 16,
+    TYPE_MAP = 17,
+    TYPE_DURATION = 18,
+    TYPE_LARGE_BINARY = 19,
+    TYPE_LARGE_UTF8 = 20,
+    TYPE_LARGE_LIST = 21,
+};
+
+// structs of File.fbs and Message.fbs
+struct ArrowBlock {
+    int64_t offset;
+    int32_t metadata_length;
+    int32_t padding;
+    int64_t body_length;
+};
+
+struct ArrowFieldNode {
+    int64_t length;
+    int64_t null_count;
+};
+
+struct ArrowBuffer {
+    int64_t offset;
+    int64_t length;
+};
+
+static void arrow_error(const std::string &file, const char *what)
+{
+    fprintf(stderr, "%s: %s\n", file.c_str(), what);
+    exit(1);
+}
+
+bool parse_arrow_path(const char *path, std::string &file, std::string &column)
+{
+    for (const char *ext : {".arrow", ".feather"}) {
+        const char *found = strstr(path, ext);
+        if (found == NULL) {
+            continue;
+        }
+        const char *end = found + strlen(ext);
+        if (*end == '\0' || *end == ':') {
+            file.assign(path, end - path);
+            column = *end == ':' ? end + 1 : "";
+            return true;
+        }
+    }
+    return false;
+}
+
+// A flatbuffers table inside the mapped file, every access is checked
+// against the bounds of the mapping
+class FlatTable {
+public:
+    FlatTable(const uint8_t *table, const uint8_t *lo, const uint8_t *hi,
+              const std::string &file)
+        : table(table), lo(lo), hi(hi), file(&file) {
+        check(table, 4);
+        vtable = table - load<int32_t>(table);
+        check(vtable, 4);
+        vtable_size = load<uint16_t>(vtable);
+        check(vtable, vtable_size);
+    }
+
+    template<typename S>
+    S scalar(int id, S fallback) const {
+        const uint8_t *p = field(id);
+        return p == NULL ? fallback : load<S>(p);
+    }
+
+    bool has(int id) const { return field(id) != NULL; }
+
+    FlatTable table_field(int id) const {
+        const uint8_t *p = target(id);
+        if (p == NULL) {
+            arrow_error(*file, "missing table in the metadata");
+        }
+        return FlatTable(p, lo, hi, *file);
+    }
+
+    // elements of a vector, NULL and 0 when absent
+    const uint8_t *vector(int id, size_t elem_size, uint32_t &count) const {
+        const uint8_t *p = target(id);
+        count = 0;
+        if (p == NULL) {
+            return NULL;
+        }
+        count = load<uint32_t>(p);
+        check(p + 4, (size_t)count * elem_size);
+        return p + 4;
+    }
+
+    // the i-th table of a vector of tables
+    FlatTable table_at(const uint8_t *elems, uint32_t i) const {
+        const uint8_t *p = elems + 4 * i;
+        return FlatTable(p + load<uint32_t>(p), lo, hi, *file);
+    }
+
+    std::string string(int id) const {
+        uint32_t len;
+        const uint8_t *chars = vector(id, 1, len);
+        return std::string((const char *)chars, len);
+    }
+
+private:
+    const uint8_t *field(int id) const {
+        if (4 + 2 * id + 2 > vtable_size) {
+            return NULL;
+        }
+        uint16_t offset = load<uint16_t>(vtable + 4 + 2 * id);
+        return offset == 0 ? NULL : table + offset;
+    }
+
+    const uint8_t *target(int id) const {
+        const uint8_t *p = field(id);
+        return p == NULL ? NULL : p + load<uint32_t>(p);
+    }
+
+    template<typename S>
+    S load(const uint8_t *p) const {
+        check(p, sizeof(S));
+        S value;
+        memcpy(&value, p, sizeof(S));
+        return value;
+    }
+
+    void check(const uint8_t *p, size_t bytes) const {
+        if (p < lo || p > hi || bytes > (size_t)(hi - p)) {
+            arrow_error(*file, "malformed Arrow metadata");
+        }
+    }
+
+    const uint8_t *table;
+    const uint8_t *vtable;
+    uint16_t vtable_size;
+    const uint8_t *lo;
+    const uint8_t *hi;
+    const std::string *file;
+};
+
+// Field nodes and buffers taken by a field and its children in a record
+// batch, the nodes and buffers of all fields are stored in field order
+static void count_layout(const FlatTable &field, const std::string &file,
+                         size_t &nodes, size_t &buffers)
+{
+    nodes++;
+    if (field.has(4)) {
+        // a dictionary-encoded field holds the validity and the indices,
+        // its values and their children are in the dictionary batches
+        buffers += 2;
+        return;
+    }
+    switch (field.scalar<uint8_t>(2, 0)) {
+    case TYPE_NULL:
+        break;
+    case TYPE_INT:
+    case TYPE_FLOATING_POINT:
+    case TYPE_BOOL:
+    case TYPE_DECIMAL:
+    case TYPE_DATE:
+    case TYPE_TIME:
+    case TYPE_TIMESTAMP:
+    case TYPE_INTERVAL:
+    case TYPE_FIXED_SIZE_BINARY:
+    case TYPE_DURATION:
+    case TYPE_LIST:
+    case TYPE_LARGE_LIST:
+    case TYPE_MAP:
+        buffers += 2;
+        break;
+    case TYPE_BINARY:
+    case TYPE_UTF8:
+    case TYPE_LARGE_BINARY:
+    case TYPE_LARGE_UTF8:
+        buffers += 3;
+        break;
+    case TYPE_STRUCT:
+    case TYPE_FIXED_SIZE_LIST:
+        buffers += 1;
+        break;
+    default:
+        arrow_error(file, "unsupported column type");
+    }
+    uint32_t num_children;
+    const uint8_t *children = field.vector(5, 4, num_children);
+    for (uint32_t i = 0; i < num_children; i++) {
+        count_layout(field.table_at(children, i), file, nodes, buffers);
+    }
+}
+
+template<typename T>
+ArrowColumnReader<T>::ArrowColumnReader(const std::string &file, const std::string &column)
+    : column(column), base(MAP_FAILED), length(0), num_keys(0)
+{
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        perror(file.c_str());
+        exit(1);
+    }
+    struct stat st;
+    fstat(fd, &st);
+    length = st.st_size;
+    if (length < 2 * 8 + 4) {
+        arrow_error(file, "not an Arrow IPC file");
+    }
+    // private and writable, so the keys can be sorted where they are
+    base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror(file.c_str());
+        exit(1);
+    }
+    const uint8_t *lo = (const uint8_t *)base;
+    const uint8_t *hi = lo + length;
+    if (memcmp(lo, ARROW_MAGIC, 6) != 0 || memcmp(hi - 6, ARROW_MAGIC, 6) != 0) {
+        arrow_error(file, "not an Arrow IPC file");
+    }
+    int32_t footer_length;
+    memcpy(&footer_length, hi - 10, sizeof(footer_length));
+    if (footer_length <= 0 || (size_t)footer_length > length - 18) {
+        arrow_error(file, "malformed Arrow footer");
+    }
+    const uint8_t *footer_buf = hi - 10 - footer_length;
+    uint32_t root;
+    memcpy(&root, footer_buf, sizeof(root));
+    FlatTable footer(footer_buf + root, lo, hi, file);
+
+    // find the column and where its nodes and buffers are in a batch
+    FlatTable schema = footer.table_field(1);
+    uint32_t num_fields;
+    const uint8_t *fields = schema.vector(1, 4, num_fields);
+    size_t node = 0, buffer = 0;
+    uint32_t i = 0;
+    for (; i < num_fields; i++) {
+        FlatTable field = footer.table_at(fields, i);
+        std::string name = field.string(0);
+        if (column.empty() ? true : name == column) {
+            this->column = name;
+            if (field.scalar<uint8_t>(2, 0) != TYPE_INT || field.has(4)) {
+                arrow_error(file, "the key column is not a plain integer column");
+            }
+            FlatTable type = field.table_field(3);
+            if (type.scalar<int32_t>(0, 0) != 8 * (int32_t)sizeof(T)
+                    || type.scalar<uint8_t>(1, 0) != std::is_signed<T>::value) {
+                arrow_error(file, "the key column does not hold keys of the key type");
+            }
+            break;
+        }
+        count_layout(field, file, node, buffer);
+    }
+    if (i == num_fields) {
+        arrow_error(file, "no such column");
+    }
+    // every batch must have the nodes and buffers of all the fields,
+    // or the offsets of the key column would be wrong
+    size_t total_nodes = node, total_buffers = buffer;
+    for (; i < num_fields; i++) {
+        count_layout(footer.table_at(fields, i), file, total_nodes, total_buffers);
+    }
+    // the values follow the validity bitmap
+    buffer++;
+
+    uint32_t num_batches;
+    const uint8_t *batches = footer.vector(3, sizeof(ArrowBlock), num_batches);
+    for (uint32_t b = 0; b < num_batches; b++) {
+        ArrowBlock block;
+        memcpy(&block, batches + b * sizeof(ArrowBlock), sizeof(block));
+        if (block.offset < 0 || block.metadata_length < 8 || block.body_length < 0
+                || (uint64_t)block.offset + block.metadata_length + block.body_length > length) {
+            arrow_error(file, "malformed Arrow block");
+        }
+        // the metadata may start with a continuation marker
+        const uint8_t *message_buf = lo + block.offset + 4;
+        uint32_t marker;
+        memcpy(&marker, lo + block.offset, sizeof(marker));
+        if (marker == CONTINUATION) {
+            message_buf += 4;
+        }
+        memcpy(&root, message_buf, sizeof(root));
+        FlatTable message(message_buf + root, lo, hi, file);
+        if (message.scalar<uint8_t>(1, 0) != HEADER_RECORD_BATCH) {
+            arrow_error(file, "a block is not a record batch");
+        }
+        FlatTable batch = message.table_field(2);
+        if (batch.has(3)) {
+            arrow_error(file, "compressed record batches are not supported");
+        }
+        uint32_t num_nodes, num_buffers;
+        const uint8_t *nodes = batch.vector(1, sizeof(ArrowFieldNode), num_nodes);
+        const uint8_t *buffers = batch.vector(2, sizeof(ArrowBuffer), num_buffers);
+        if (num_nodes != total_nodes || num_buffers != total_buffers) {
+            arrow_error(file, "unexpected record batch layout");
+        }
+        ArrowFieldNode field_node;
+        memcpy(&field_node, nodes + node * sizeof(ArrowFieldNode), sizeof(field_node));
+        if (field_node.null_count != 0) {
+            arrow_error(file, "the key column has nulls");
+        }
+        ArrowBuffer values;
+        memcpy(&values, buffers + buffer * sizeof(ArrowBuffer), sizeof(values));
+        size_t n = field_node.length;
+        if (values.offset < 0 || (uint64_t)values.offset + sizeof(T) * n > (uint64_t)block.body_length) {
+            arrow_error(file, "malformed Arrow buffer");
+        }
+        if (n > 0) {
+            uint8_t *body = (uint8_t *)base + block.offset + block.metadata_length;
+            chunks.emplace_back((T *)(body + values.offset), n);
+            num_keys += n;
+        }
+    }
+}
+
+template<typename T>
+ArrowColumnReader<T>::~ArrowColumnReader()
+{
+    munmap(base, length);
+}
+
+template<typename T>
+void ArrowColumnReader<T>::read_all(T *dst) const
+{
+    for (auto &chunk : chunks) {
+        memcpy(dst, chunk.first, sizeof(T) * chunk.second);
+        dst += chunk.second;
+    }
+}
+
+// Lays out a flatbuffer front to back. A table is written before the
+// tables, vectors and strings it refers to, and their offsets are filled
+// in once they are written.
+class FlatBuilder {
+public:
+    struct Field {
+        int id;
+        size_t size;
+        uint64_t value;
+    };
+
+    // the root offset comes first
+    FlatBuilder() : buf(4, 0) {}
+
+    // Write a table of scalar fields, and of offset fields of size 4 to be
+    // filled in by point_to(). Returns the table and the field positions.
+    size_t table(std::vector<Field> fields, std::map<int, size_t> &positions) {
+        // larger fields first keeps every field aligned
+        std::stable_sort(fields.begin(), fields.end(),
+                [](const Field &a, const Field &b) { return a.size > b.size; });
+        int num_ids = 0;
+        for (auto &field : fields) {
+            num_ids = std::max(num_ids, field.id + 1);
+        }
+        align(2);
+        size_t vtable = buf.size();
+        buf.resize(vtable + 4 + 2 * num_ids, 0);
+        // the 8-byte fields right after the 4-byte vtable offset are aligned
+        while (buf.size() % 8 != 4) {
+            buf.push_back(0);
+        }
+        size_t table = buf.size();
+        buf.resize(table + 4);
+        put<int32_t>(table, table - vtable);
+        size_t end = table + 4;
+        for (auto &field : fields) {
+            size_t pos = end;
+            positions[field.id] = pos;
+            buf.resize(pos + field.size, 0);
+            memcpy(&buf[pos], &field.value, field.size);
+            put<uint16_t>(vtable + 4 + 2 * field.id, pos - table);
+            end = pos + field.size;
+        }
+        put<uint16_t>(vtable, 4 + 2 * num_ids);
+        put<uint16_t>(vtable + 2, end - table);
+        return table;
+    }
+
+    // vector of `count` structs of `elem_size` bytes aligned to 8
+    size_t vector(const void *elems, uint32_t count, size_t elem_size) {
+        while (buf.size() % 8 != 4) {
+            buf.push_back(0);
+        }
+        size_t pos = buf.size();
+        buf.resize(pos + 4 + count * elem_size);
+        put<uint32_t>(pos, count);
+        if (count > 0) {
+            memcpy(&buf[pos + 4], elems, count * elem_size);
+        }
+        return pos;
+    }
+
+    // vector of `count` offsets to be filled in, the i-th one is at
+    // the returned position + 4 + 4 * i
+    size_t offsets(uint32_t count) {
+        align(4);
+        size_t pos = buf.size();
+        buf.resize(pos + 4 + 4 * count, 0);
+        put<uint32_t>(pos, count);
+        return pos;
+    }
+
+    size_t string(const std::string &s) {
+        align(4);
+        size_t pos = buf.size();
+        buf.resize(pos + 4 + s.size() + 1, 0);
+        put<uint32_t>(pos, s.size());
+        memcpy(&buf[pos + 4], s.data(), s.size());
+        return pos;
+    }
+
+    // offset at `pos` refers to `target`
+    void point_to(size_t pos, size_t target) { put<uint32_t>(pos, target - pos); }
+
+    // padded to 8 bytes, as messages and the footer must be
+    std::vector<uint8_t> &finish() {
+        align(8);
+        return buf;
+    }
+
+private:
+    void align(size_t bytes) {
+        while (buf.size() % bytes != 0) {
+            buf.push_back(0);
+        }
+    }
+
+    template<typename S>
+    void put(size_t pos, S value) { memcpy(&buf[pos], &value, sizeof(S)); }
+
+    std::vector<uint8_t> buf;
+};
+
+// Schema of one non-nullable integer field
+template<typename T>
+static size_t build_schema(FlatBuilder &fb, const std::string &column)
+{
+    std::map<int, size_t> at;
+    size_t schema = fb.table({{1, 4, 0}}, at);
+    size_t fields = fb.offsets(1);
+    fb.point_to(at[1], fields);
+    size_t field = fb.table({{0, 4, 0}, {1, 1, 0}, {2, 1, TYPE_INT}, {3, 4, 0}, {5, 4, 0}}, at);
+    fb.point_to(fields + 4, field);
+    std::map<int, size_t> field_at = at;
+    fb.point_to(field_at[0], fb.string(column));
+    size_t type = fb.table({{0, 4, 8 * sizeof(T)}, {1, 1, std::is_signed<T>::value}}, at);
+    fb.point_to(field_at[3], type);
+    fb.point_to(field_at[5], fb.vector(NULL, 0, 4));
+    return schema;
+}
+
+// Message with the schema, or with a record batch of n keys in one buffer
+template<typename T>
+static std::vector<uint8_t> build_message(const std::string &column, size_t n,
+                                          int64_t body_length)
+{
+    FlatBuilder fb;
+    std::map<int, size_t> at;
+    uint8_t header = n == (size_t)-1 ? HEADER_SCHEMA : HEADER_RECORD_BATCH;
+    size_t message = fb.table({{0, 2, (uint64_t)METADATA_V5}, {1, 1, header}, {2, 4, 0},
+                               {3, 8, (uint64_t)body_length}}, at);
+    fb.point_to(0, message);
+    size_t header_pos = at[2];
+    if (header == HEADER_SCHEMA) {
+        fb.point_to(header_pos, build_schema<T>(fb, column));
+    } else {
+        size_t batch = fb.table({{0, 8, n}, {1, 4, 0}, {2, 4, 0}}, at);
+        fb.point_to(header_pos, batch);
+        size_t nodes_pos = at[1], buffers_pos = at[2];
+        ArrowFieldNode node {(int64_t)n, 0};
+        fb.point_to(nodes_pos, fb.vector(&node, 1, sizeof(node)));
+        // no validity bitmap, the values start the body
+        ArrowBuffer buffers[2] = {{0, 0}, {0, (int64_t)(sizeof(T) * n)}};
+        fb.point_to(buffers_pos, fb.vector(buffers, 2, sizeof(ArrowBuffer)));
+    }
+    return fb.finish();
+}
+
+// Write an encapsulated message, returns its metadata length
+static int32_t write_message(ChunkWriter &writer, const std::vector<uint8_t> &flatbuf)
+{
+    int32_t size = flatbuf.size();
+    writer.write(&CONTINUATION, sizeof(CONTINUATION));
+    writer.write(&size, sizeof(size));
+    writer.write(flatbuf.data(), flatbuf.size());
+    return 8 + size;
+}
+
+template<typename T>
+void write_arrow_column(const char *path, const std::string &column,
+                        const T *keys, size_t n, const IoOptions &io)
+{
+    static const char zeros[8] = {};
+    ChunkWriter writer(path, io);
+    writer.write(ARROW_MAGIC, 6);
+    writer.write(zeros, 2);
+    write_message(writer, build_message<T>(column, (size_t)-1, 0));
+
+    size_t values = sizeof(T) * n;
+    int64_t body_length = (values + 7) / 8 * 8;
+    ArrowBlock block {(int64_t)writer.size(), 0, 0, body_length};
+    block.metadata_length = write_message(writer, build_message<T>(column, n, body_length));
+    writer.write(keys, values);
+    writer.write(zeros, body_length - values);
+
+    FlatBuilder fb;
+    std::map<int, size_t> at;
+    size_t footer = fb.table({{0, 2, (uint64_t)METADATA_V5}, {1, 4, 0}, {3, 4, 0}}, at);
+    fb.point_to(0, footer);
+    size_t schema_pos = at[1], batches_pos = at[3];
+    fb.point_to(batches_pos, fb.vector(&block, 1, sizeof(block)));
+    fb.point_to(schema_pos, build_schema<T>(fb, column));
+    const std::vector<uint8_t> &footer_buf = fb.finish();
+    int32_t footer_length = footer_buf.size();
+    writer.write(footer_buf.data(), footer_buf.size());
+    writer.write(&footer_length, sizeof(footer_length));
+    writer.write(ARROW_MAGIC, 6);
+    writer.finish();
+}
+
+template class ArrowColumnReader<int>;
+template class ArrowColumnReader<int16_t>;
+template class ArrowColumnReader<uint16_t>;
+template class ArrowColumnReader<uint8_t>;
+template void write_arrow_column<int>(const char *, const std::string &, const int *,
+        size_t, const IoOptions &);
+template void write_arrow_column<int16_t>(const char *, const std::string &, const int16_t *,
+        size_t, const IoOptions &);
+template void write_arrow_column<uint16_t>(const char *, const std::string &, const uint16_t *,
+        size_t, const IoOptions &);
+template void write_arrow_column<uint8_t>(const char *, const std::string &, const uint8_t *,
+        size_t, const IoOptions &);
+
+} // namespace bitonic
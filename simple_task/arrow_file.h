@@ -0,0 +1,58 @@
+// Arrow IPC files of keys
+// Integer columns of uncompressed Arrow IPC files (the random access
+// format, .arrow or .feather) are read from a private memory mapping of
+// the file. A column stored in a single record batch is one buffer in the
+// mapping, which the sorter attaches as its input instance without
+// copying. Sorted keys are written as a file of one column in one batch.
+// The metadata flatbuffers are parsed and built here, without the Arrow
+// libraries.
+
+#ifndef BITONIC_ARROW_FILE_H
+#define BITONIC_ARROW_FILE_H
+
+#include <string>
+#include <vector>
+#include "bitonic.h"
+#include "io.h"
+
+namespace bitonic {
+
+// Split "file.arrow:column" into the file and the column, which is empty
+// when only the file is given. False if `path` is not an Arrow file.
+bool parse_arrow_path(const char *path, std::string &file, std::string &column);
+
+// An integer column of keys of type T, the first column when `column` is
+// empty. The column must have no nulls.
+template<typename T>
+class ArrowColumnReader {
+public:
+    ArrowColumnReader(const std::string &file, const std::string &column);
+    ~ArrowColumnReader();
+
+    size_t size() const { return num_keys; }
+    const std::string &name() const { return column; }
+
+    // the keys in the mapping when they are one buffer, NULL otherwise,
+    // writes stay private to this process
+    T *data() { return chunks.size() == 1 ? chunks[0].first : NULL; }
+
+    // copy the keys of all record batches
+    void read_all(T *dst) const;
+
+private:
+    std::string column;
+    void *base;
+    size_t length;
+    size_t num_keys;
+    // keys of each record batch
+    std::vector<std::pair<T *, size_t>> chunks;
+};
+
+// Write `keys` as an Arrow IPC file with one non-nullable column
+template<typename T>
+void write_arrow_column(const char *path, const std::string &column,
+                        const T *keys, size_t n, const IoOptions &io = IoOptions());
+
+} // namespace bitonic
+
+#endif // BITONIC_ARROW_FILE_H
@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+# Performance regression suite for the bitonic sorter
+#
+# Runs the sorter over the matrix in matrix.json (sizes x distributions x
+# key types x engines x cpus), takes the median throughput of each case,
+# and compares it with a recorded baseline. Exits with status 1 when a case
+# is slower than the baseline by more than its tolerance.
+#
+#   run_bench.py --binary ../bitonic_sorter              compare with baseline
+#   run_bench.py --binary ../bitonic_sorter --record     record a new baseline
+
+import argparse
+import fnmatch
+import json
+import os
+import re
+import statistics
+import subprocess
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+TIME_RE = re.compile(r"sort time: ([0-9.]+) ms, ([0-9.]+) Mkeys/s")
+
+
+def cases(matrix):
+    for n in matrix["sizes"]:
+        for dist in matrix["dists"]:
+            for keytype in matrix["keytypes"]:
+                for engine, flags in matrix["engines"].items():
+                    for cpus in matrix["cpus"]:
+                        name = "n%d-%s-%s-%s-cpu%d" % (n, dist, keytype, engine, cpus)
+                        args = ["-n", str(n), "-dist", dist, "-keytype", keytype,
+                                "-ll:cpu", str(cpus), "-quiet"] + flags
+                        yield name, args
+
+
+def tolerance(matrix, name, default):
+    tol = default
+    for pattern, override in matrix.get("overrides", {}).items():
+        if fnmatch.fnmatch(name, pattern):
+            tol = override.get("tolerance", tol)
+    return tol
+
+
+def run_case(binary, args, repeats):
+    rates = []
+    for _ in range(repeats):
+        proc = subprocess.run([binary] + args, capture_output=True, text=True)
+        out = proc.stdout
+        if proc.returncode != 0 or "OUT OF ORDER" in out:
+            raise RuntimeError("%s %s failed:\n%s%s"
+                               % (binary, " ".join(args), out, proc.stderr))
+        match = TIME_RE.search(out)
+        if not match:
+            raise RuntimeError("no timing in output of %s %s:\n%s"
+                               % (binary, " ".join(args), out))
+        rates.append(float(match.group(2)))
+    return statistics.median(rates)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--binary", default=os.path.join(HERE, "..", "bitonic_sorter"))
+    parser.add_argument("--matrix", default=os.path.join(HERE, "matrix.json"))
+    parser.add_argument("--baseline", default=os.path.join(HERE, "baseline.json"))
+    parser.add_argument("--results", default=os.path.join(HERE, "results.json"))
+    parser.add_argument("--tolerance", type=float,
+                        help="allowed slowdown, overrides the matrix default")
+    parser.add_argument("--filter", default="*", help="only run cases matching this glob")
+    parser.add_argument("--record", action="store_true",
+                        help="write the results as the new baseline")
+    opts = parser.parse_args()
+
+    with open(opts.matrix) as f:
+        matrix = json.load(f)
+    default_tol = opts.tolerance if opts.tolerance is not None else matrix["tolerance"]
+
+    baseline = None
+    if not opts.record:
+        if not os.path.exists(opts.baseline):
+            sys.exit("no baseline at %s\n"
+                     "record one on this host with `make bench-baseline` first"
+                     % opts.baseline)
+        with open(opts.baseline) as f:
+            baseline = json.load(f)
+
+    results = {}
+    for name, args in cases(matrix):
+        if not fnmatch.fnmatch(name, opts.filter):
+            continue
+        results[name] = run_case(opts.binary, args, matrix["repeats"])
+        print("%-40s %10.3f Mkeys/s" % (name, results[name]), flush=True)
+
+    out = opts.baseline if opts.record else opts.results
+    with open(out, "w") as f:
+        json.dump(results, f, indent=4, sort_keys=True)
+    if opts.record:
+        print("recorded baseline in %s" % out)
+        return 0
+
+    regressions = []
+    for name, rate in sorted(results.items()):
+        if name not in baseline:
+            print("%s: not in baseline, skipped" % name)
+            continue
+        tol = opts.tolerance if opts.tolerance is not None \
+            else tolerance(matrix, name, default_tol)
+        change = rate / baseline[name] - 1
+        if change < -tol:
+            regressions.append((name, baseline[name], rate, change, tol))
+
+    if not regressions:
+        print("no regressions in %d cases" % len(results))
+        return 0
+    print("\n%d regressions:" % len(regressions))
+    print("%-40s %12s %12s %8s %8s" % ("case", "baseline", "current", "change", "allowed"))
+    for name, base, rate, change, tol in regressions:
+        print("%-40s %12.3f %12.3f %+7.1f%% %+7.1f%%"
+              % (name, base, rate, 100 * change, -100 * tol))
+    return 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
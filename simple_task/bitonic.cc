@@ -0,0 +1,915 @@
+// Bitonic sorter library
+// The algorithm is described here https://en.wikipedia.org/wiki/Bitonic_sorter
+// Author: dongyan (Andy)
+
+#include <algorithm>
+#include <cassert>
+#include <map>
+#include "bitonic.h"
+#include "bitonic_kernels.h"
+#include "permute.h"
+#include "search.h"
+#include "shards.h"
+#include "stats.h"
+
+using namespace Legion;
+
+namespace bitonic {
+
+// Tasks that handle keys are registered once per key type,
+// the key type is added to the base task id.
+enum {
+    SUBSORTER_TASK_ID,
+    SINGLE_SWAP_TASK_ID = SUBSORTER_TASK_ID + NUM_KEY_TYPES,
+    LEAF_SORT_TASK_ID = SINGLE_SWAP_TASK_ID + NUM_KEY_TYPES,
+    MIN_MAX_TASK_ID = LEAF_SORT_TASK_ID + NUM_KEY_TYPES,
+    SORT_REGION_TASK_ID = MIN_MAX_TASK_ID + NUM_KEY_TYPES,
+    RECURSIVE_SORT_TASK_ID = SORT_REGION_TASK_ID + NUM_KEY_TYPES,
+    SEARCH_INDEX_TASK_ID = RECURSIVE_SORT_TASK_ID + NUM_KEY_TYPES,
+    PERMUTE_TASK_ID = SEARCH_INDEX_TASK_ID + NUM_KEY_TYPES,
+    // the permute tasks take two ids
+    SHARD_TASK_ID = PERMUTE_TASK_ID + 2,
+};
+
+static TaskID task_id_base = DEFAULT_TASK_ID_BASE;
+
+template<typename T>
+TaskID task_id(TaskID base) {
+    return task_id_base + base + KeyTraits<T>::type;
+}
+
+enum {
+    FID_SCRATCH,
+};
+
+// Smallest and largest key of a chunk, returned as a POD future
+struct KeyRange {
+    long long min;
+    long long max;
+};
+
+// Arguments of a subsorter task
+struct SubsorterArgs {
+    int leaf_size;
+    // both input blocks come from one region instead of two futures
+    bool input_in_region;
+    // the result goes to a region instead of the returned future
+    bool output_in_region;
+    bool stream_merge;
+    // for the trace, levels count from the leaf blocks
+    int level;
+    int block;
+};
+
+// Arguments of a leaf sort task, the keys follow
+struct LeafSortArgs {
+    // for the trace, leaves are level 0
+    int block;
+};
+
+// Arguments of a recursive sort task, its keys follow them unless the
+// block is in a region
+struct RecursiveSortArgs {
+    int leaf_size;
+    bool stream_merge;
+    // blocks of at least this many bytes are sorted in place in a scratch
+    // region instead of passing through the arguments and futures
+    size_t region_threshold;
+    // the block is in region requirement 0
+    bool in_region;
+    // for the trace, as for the subsorter of the same block
+    int level;
+    int block;
+};
+
+// Two scratch regions for sorted blocks that are too large for futures,
+// each merge level reads the blocks written by the previous level
+// from one region and writes its own blocks to the other.
+struct ScratchRegions {
+    IndexSpace is;
+    FieldSpace fs;
+    LogicalRegion lr[2];
+    // equal partitions of `is`, keyed by the number of blocks
+    std::map<int, IndexPartition> partitions;
+
+    void create(Context ctx, Runtime *runtime, int num_total, size_t key_size) {
+        is = runtime->create_index_space(ctx, Rect<1>(0, num_total - 1));
+        fs = runtime->create_field_space(ctx);
+        FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
+        allocator.allocate_field(key_size, FID_SCRATCH);
+        lr[0] = runtime->create_logical_region(ctx, is, fs);
+        lr[1] = runtime->create_logical_region(ctx, is, fs);
+    }
+
+    // the j-th of `num_blocks` equal blocks of region k
+    LogicalRegion block(Context ctx, Runtime *runtime, int k, int num_blocks, int j) {
+        auto it = partitions.find(num_blocks);
+        if (it == partitions.end()) {
+            IndexSpace colors = runtime->create_index_space(ctx, Rect<1>(0, num_blocks - 1));
+            IndexPartition ip = runtime->create_equal_partition(ctx, is, colors);
+            runtime->destroy_index_space(ctx, colors);
+            it = partitions.emplace(num_blocks, ip).first;
+        }
+        LogicalPartition lp = runtime->get_logical_partition(ctx, lr[k], it->second);
+        return runtime->get_logical_subregion_by_color(ctx, lp, DomainPoint(Point<1>(j)));
+    }
+
+    void destroy(Context ctx, Runtime *runtime) {
+        runtime->destroy_logical_region(ctx, lr[0]);
+        runtime->destroy_logical_region(ctx, lr[1]);
+        runtime->destroy_field_space(ctx, fs);
+        runtime->destroy_index_space(ctx, is);
+    }
+};
+
+// the field a sorter task reads or writes through region requirement i
+static FieldID block_field(const Task *task, int i)
+{
+    assert(task->regions[i].privilege_fields.size() == 1);
+    return *task->regions[i].privilege_fields.begin();
+}
+
+template<typename T>
+void read_block(Context ctx, Runtime *runtime, const PhysicalRegion &region,
+                FieldID fid, T *dst)
+{
+    const FieldAccessor<READ_ONLY, T, 1, coord_t, Realm::AffineAccessor<T, 1, coord_t>>
+        keys(region, fid);
+    Rect<1> rect = runtime->get_index_space_domain(ctx,
+            region.get_logical_region().get_index_space());
+    memcpy(dst, keys.ptr(rect.lo), sizeof(T) * rect.volume());
+}
+
+// `src` may hold more keys than the region, as the
+// final block keeps its padding past the caller's keys
+template<typename T>
+void write_block(Context ctx, Runtime *runtime, const PhysicalRegion &region,
+                 FieldID fid, const T *src)
+{
+    const FieldAccessor<WRITE_DISCARD, T, 1, coord_t, Realm::AffineAccessor<T, 1, coord_t>>
+        keys(region, fid);
+    Rect<1> rect = runtime->get_index_space_domain(ctx,
+            region.get_logical_region().get_index_space());
+    memcpy(keys.ptr(rect.lo), src, sizeof(T) * rect.volume());
+}
+
+// Launcher of the leaf sort task of block `block`, which holds the n
+// keys at `keys`. `buffer` keeps the arguments until the launch.
+template<typename T>
+TaskLauncher leaf_launcher(int block, const T *keys, int n, std::vector<char> &buffer)
+{
+    LeafSortArgs args {block};
+    buffer.resize(sizeof(args) + sizeof(T) * n);
+    memcpy(buffer.data(), &args, sizeof(args));
+    memcpy(buffer.data() + sizeof(args), keys, sizeof(T) * n);
+    return TaskLauncher(task_id<T>(LEAF_SORT_TASK_ID),
+                        TaskArgument(buffer.data(), buffer.size()));
+}
+
+// Launch a recursive sort task for the n keys at `keys`, or for the
+// keys of `block`, a subregion of `parent`, which the task sorts in place.
+// The result goes to `output` instead when it is given, and otherwise to
+// the future for blocks passed by value.
+template<typename T>
+Future launch_recursive(Context ctx, Runtime *runtime, RecursiveSortArgs args,
+                        const T *keys, int n,
+                        LogicalRegion block = LogicalRegion::NO_REGION,
+                        LogicalRegion parent = LogicalRegion::NO_REGION,
+                        LogicalRegion output = LogicalRegion::NO_REGION,
+                        FieldID output_fid = 0)
+{
+    args.in_region = block.exists();
+    std::vector<char> buffer;
+    if (args.in_region) {
+        buffer.resize(sizeof(args));
+        memcpy(buffer.data(), &args, sizeof(args));
+    } else if (n <= args.leaf_size && !output.exists()) {
+        // a leaf block needs no merge
+        TaskLauncher leaf_sorter = leaf_launcher<T>(args.block, keys, n, buffer);
+        return runtime->execute_task(ctx, leaf_sorter);
+    } else {
+        buffer.resize(sizeof(args) + sizeof(T) * n);
+        memcpy(buffer.data(), &args, sizeof(args));
+        memcpy(buffer.data() + sizeof(args), keys, sizeof(T) * n);
+    }
+    TaskLauncher sorter(task_id<T>(RECURSIVE_SORT_TASK_ID),
+                        TaskArgument(buffer.data(), buffer.size()));
+    if (args.in_region) {
+        sorter.add_region_requirement(RegionRequirement(block, READ_WRITE, EXCLUSIVE, parent));
+        sorter.region_requirements.back().add_field(FID_SCRATCH);
+    }
+    if (output.exists()) {
+        sorter.add_region_requirement(RegionRequirement(output, WRITE_DISCARD, EXCLUSIVE, output));
+        sorter.region_requirements.back().add_field(output_fid);
+    }
+    return runtime->execute_task(ctx, sorter);
+}
+
+// Sort the padded keys with one recursive sort task, which launches the
+// tasks for its two halves and merges their results. The tree of tasks
+// unfolds on the processors that run its inner tasks, instead of the
+// caller launching every task of every level. Blocks from the region
+// threshold on are sorted in place in a scratch region, smaller blocks
+// pass through the arguments and futures.
+template<typename T>
+MyVec<T> sort_recursive(Context ctx, Runtime *runtime,
+                        const std::vector<T> &nums, const SortOptions &options,
+                        LogicalRegion output, FieldID output_fid)
+{
+    int num_total = nums.size();
+    int leaf_size = std::min(options.leaf_size, num_total);
+    int level = 0;
+    while (leaf_size << level < num_total) {
+        level++;
+    }
+    RecursiveSortArgs args {leaf_size, options.stream_merge, options.region_threshold,
+                            false, level, 0};
+    ScratchRegions scratch;
+    LogicalRegion block = LogicalRegion::NO_REGION;
+    if (sizeof(T) * num_total >= options.region_threshold) {
+        scratch.create(ctx, runtime, num_total, sizeof(T));
+        block = scratch.lr[0];
+        RegionRequirement req(block, WRITE_DISCARD, EXCLUSIVE, block);
+        req.add_field(FID_SCRATCH);
+        PhysicalRegion keys_region = runtime->map_region(ctx, req);
+        keys_region.wait_until_valid();
+        write_block(ctx, runtime, keys_region, FID_SCRATCH, nums.data());
+        runtime->unmap_region(ctx, keys_region);
+    }
+    Future result = launch_recursive<T>(ctx, runtime, args, nums.data(), num_total,
+                                        block, block, output, output_fid);
+    MyVec<T> sorted;
+    if (output.exists()) {
+        timed_wait(result);
+    } else if (block.exists()) {
+        sorted.vec.resize(num_total);
+        RegionRequirement req(block, READ_ONLY, EXCLUSIVE, block);
+        req.add_field(FID_SCRATCH);
+        PhysicalRegion final_region = runtime->map_region(ctx, req);
+        final_region.wait_until_valid();
+        read_block(ctx, runtime, final_region, FID_SCRATCH, sorted.data());
+        runtime->unmap_region(ctx, final_region);
+    } else {
+        sorted = timed_get_result<MyVec<T>>(result);
+        assert(sorted.size() == num_total);
+    }
+    if (block.exists()) {
+        scratch.destroy(ctx, runtime);
+    }
+    return sorted;
+}
+
+// Sort the keys with bitonic sorter tasks,
+// the result is padded with max values up to a power of 2.
+// When `output` is given, the final merge writes the first keys of the
+// result to its field directly and an empty vector is returned.
+template<typename T>
+MyVec<T> sort_keys(Context ctx, Runtime *runtime,
+                   std::vector<T> nums, const SortOptions &options,
+                   LogicalRegion output = LogicalRegion::NO_REGION,
+                   FieldID output_fid = 0)
+{
+    // find the next-least power of 2,
+    // and to fill up with max values
+    int num_inputs = nums.size();
+    int num_total = num_inputs;
+    while (num_total != (num_total & (-num_total))) {
+        num_total += (num_total & (-num_total));
+    }
+    for (int i = num_inputs; i < num_total; i++) {
+        nums.push_back(std::numeric_limits<T>::max());
+    }
+    int leaf_size = std::min(options.leaf_size, num_total);
+    if (options.recursive) {
+        return sort_recursive<T>(ctx, runtime, nums, options, output, output_fid);
+    }
+
+    // blocks from this size on are passed through the scratch regions,
+    // level i writes to region i % 2
+    auto in_region = [&](int block) {
+        return sizeof(T) * block >= options.region_threshold;
+    };
+    bool use_scratch = output.exists()
+        ? num_total > leaf_size && in_region(num_total / 2)
+        : in_region(num_total);
+    ScratchRegions scratch;
+    if (use_scratch) {
+        scratch.create(ctx, runtime, num_total, sizeof(T));
+    }
+    int level = 0;
+    // the final block goes to the output field instead of a scratch region
+    auto add_output = [&](TaskLauncher &launcher) {
+        launcher.add_region_requirement(
+                RegionRequirement(output, WRITE_DISCARD, EXCLUSIVE, output));
+        launcher.region_requirements.back().add_field(output_fid);
+    };
+
+    // First, sort leaf blocks to acquire initial future results
+    std::vector<std::vector<Future>> iterResults;
+    std::vector<Future> results;
+    std::vector<char> leaf_args;
+    for (int lo = 0; lo < num_total; lo += leaf_size) {
+        TaskLauncher leaf_sorter = leaf_launcher<T>(lo / leaf_size, &nums[lo], leaf_size,
+                                                    leaf_args);
+        if (leaf_size == num_total && output.exists()) {
+            add_output(leaf_sorter);
+        } else if (in_region(leaf_size)) {
+            LogicalRegion out = scratch.block(ctx, runtime, level % 2,
+                                              num_total / leaf_size, lo / leaf_size);
+            leaf_sorter.add_region_requirement(
+                    RegionRequirement(out, WRITE_DISCARD, EXCLUSIVE, scratch.lr[level % 2]));
+            leaf_sorter.region_requirements.back().add_field(FID_SCRATCH);
+        }
+        Future res = runtime->execute_task(ctx, leaf_sorter);
+        results.push_back(res);
+    }
+    iterResults.push_back(results);
+
+    // Then iteratively merge sorting results from previous operations,
+    for (int gap = leaf_size * 2; gap <= num_total; gap <<= 1) {
+        int j = 0;
+        std::vector<Future> results;
+        bool final_level = gap == num_total && output.exists();
+        SubsorterArgs args {leaf_size, in_region(gap / 2), in_region(gap) || final_level,
+                            options.stream_merge, level + 1, 0};
+        for (int lo = 0; lo < num_total; lo += gap) {
+            args.block = j;
+            // spawn a sub-task for each subsorter block
+            // a subsorter requires the sorting results of two previous subsorters
+            TaskLauncher subsorter(task_id<T>(SUBSORTER_TASK_ID),
+                                   TaskArgument(&args, sizeof(args)));
+            if (args.input_in_region) {
+                // the two previous blocks are adjacent halves of this one
+                LogicalRegion in = scratch.block(ctx, runtime, level % 2, num_total / gap, j);
+                subsorter.add_region_requirement(
+                        RegionRequirement(in, READ_ONLY, EXCLUSIVE, scratch.lr[level % 2]));
+                subsorter.region_requirements.back().add_field(FID_SCRATCH);
+            } else {
+                subsorter.add_future(iterResults.back()[j * 2]);
+                subsorter.add_future(iterResults.back()[j * 2 + 1]);
+            }
+            if (final_level) {
+                add_output(subsorter);
+            } else if (args.output_in_region) {
+                LogicalRegion out = scratch.block(ctx, runtime, (level + 1) % 2, num_total / gap, j);
+                subsorter.add_region_requirement(
+                        RegionRequirement(out, WRITE_DISCARD, EXCLUSIVE, scratch.lr[(level + 1) % 2]));
+                subsorter.region_requirements.back().add_field(FID_SCRATCH);
+            }
+            Future res = runtime->execute_task(ctx, subsorter);
+            results.push_back(res);
+            j++;
+        }
+        iterResults.push_back(results);
+        level++;
+    }
+    assert(iterResults.back().size() == 1);
+
+    if (output.exists()) {
+        // wait for the final merge before the scratch regions go away
+        timed_wait(iterResults.back()[0]);
+        if (use_scratch) {
+            scratch.destroy(ctx, runtime);
+        }
+        return MyVec<T>();
+    }
+    if (!in_region(num_total)) {
+        auto final_result = iterResults.back()[0];
+        auto sorted = timed_get_result<MyVec<T>>(final_result);
+        assert(sorted.size() == num_total);
+        return sorted;
+    }
+
+    MyVec<T> sorted(num_total);
+    RegionRequirement req(scratch.lr[level % 2], READ_ONLY, EXCLUSIVE, scratch.lr[level % 2]);
+    req.add_field(FID_SCRATCH);
+    PhysicalRegion final_region = runtime->map_region(ctx, req);
+    final_region.wait_until_valid();
+    read_block(ctx, runtime, final_region, FID_SCRATCH, sorted.data());
+    runtime->unmap_region(ctx, final_region);
+    scratch.destroy(ctx, runtime);
+    return sorted;
+}
+
+// Compute the key range with one min_max task per leaf-sized chunk
+template<typename T>
+KeyRange find_key_range(Context ctx, Runtime *runtime,
+                        const std::vector<T> &nums, const SortOptions &options)
+{
+    int num_inputs = nums.size();
+    std::vector<Future> results;
+    for (int lo = 0; lo < num_inputs; lo += options.leaf_size) {
+        int num_chunk = std::min(options.leaf_size, num_inputs - lo);
+        TaskLauncher min_max(task_id<T>(MIN_MAX_TASK_ID),
+                             TaskArgument(&nums[lo], sizeof(T) * num_chunk));
+        results.push_back(runtime->execute_task(ctx, min_max));
+    }
+    KeyRange range = timed_get_result<KeyRange>(results[0]);
+    for (size_t i = 1; i < results.size(); i++) {
+        KeyRange chunk = timed_get_result<KeyRange>(results[i]);
+        range.min = std::min(range.min, chunk.min);
+        range.max = std::max(range.max, chunk.max);
+    }
+    return range;
+}
+
+// Sort keys rebased to `base` in the narrower type U,
+// and expand the sorted keys back to T
+template<typename T, typename U>
+MyVec<T> sort_rebased(Context ctx, Runtime *runtime,
+                      const std::vector<T> &nums, long long base,
+                      const SortOptions &options,
+                      LogicalRegion output, FieldID output_fid)
+{
+    debug("compressing %s keys to %s with base %lld\n",
+           KeyTraits<T>::name, KeyTraits<U>::name, base);
+    std::vector<U> narrow(nums.size());
+    for (size_t i = 0; i < nums.size(); i++) {
+        narrow[i] = (U)((long long)nums[i] - base);
+    }
+    auto sorted_narrow = sort_keys<U>(ctx, runtime, std::move(narrow), options);
+    MyVec<T> sorted(sorted_narrow.size());
+    for (size_t i = 0; i < nums.size(); i++) {
+        sorted[i] = (T)((long long)sorted_narrow[i] + base);
+    }
+    // keep the padding as max values of T
+    for (size_t i = nums.size(); i < sorted.size(); i++) {
+        sorted[i] = std::numeric_limits<T>::max();
+    }
+    if (output.exists()) {
+        RegionRequirement req(output, WRITE_DISCARD, EXCLUSIVE, output);
+        req.add_field(output_fid);
+        PhysicalRegion region = runtime->map_region(ctx, req);
+        region.wait_until_valid();
+        write_block(ctx, runtime, region, output_fid, sorted.data());
+        runtime->unmap_region(ctx, region);
+        return MyVec<T>();
+    }
+    return sorted;
+}
+
+template<typename T>
+MyVec<T> sort_values(Context ctx, Runtime *runtime,
+                     std::vector<T> nums, const SortOptions &options,
+                     LogicalRegion output, FieldID output_fid)
+{
+    MyVec<T> sorted;
+    // nothing to sort, and no leaf blocks to split the keys into
+    if (nums.empty()) {
+        return sorted;
+    }
+    if (options.compress) {
+        KeyRange range = find_key_range(ctx, runtime, nums, options);
+        unsigned long long span = (unsigned long long)(range.max - range.min);
+        if (sizeof(T) > sizeof(uint8_t) && span <= UINT8_MAX) {
+            sorted = sort_rebased<T, uint8_t>(ctx, runtime, nums, range.min, options,
+                                              output, output_fid);
+        } else if (sizeof(T) > sizeof(uint16_t) && span <= UINT16_MAX) {
+            sorted = sort_rebased<T, uint16_t>(ctx, runtime, nums, range.min, options,
+                                               output, output_fid);
+        } else {
+            sorted = sort_keys<T>(ctx, runtime, std::move(nums), options, output, output_fid);
+        }
+    } else {
+        sorted = sort_keys<T>(ctx, runtime, std::move(nums), options, output, output_fid);
+    }
+
+    return sorted;
+}
+
+// Arguments of a sort_region task
+struct SortRegionArgs {
+    SortOptions options;
+    FieldID fid;
+};
+
+// Pass the merged block of a subsorter on, to its output region if it has one
+template<typename T>
+MyVec<T> finish_subsorter(Context ctx, Runtime *runtime, const Task *task,
+                          const std::vector<PhysicalRegion> &regions, MyVec<T> &sorted)
+{
+    auto args = (const SubsorterArgs *)(task->args);
+    // may get disordered output ?
+#if DEBUG == 1
+    printf("subsorter results: ");
+    print_myvec(sorted, 0, sorted.size());
+#endif
+    if (args->output_in_region) {
+        write_block(ctx, runtime, regions.back(),
+                    block_field(task, regions.size() - 1), sorted.data());
+        return MyVec<T>();
+    }
+    return std::move(sorted);
+}
+
+// Merge the two sorted halves of `input`, with swap tasks for the
+// crosswork and the large gaps or with the local streaming merge
+template<typename T>
+MyVec<T> merge_halves(Context ctx, Runtime *runtime, const MyVec<T> &input,
+                      int leaf_size, bool stream_merge)
+{
+    int num_total = input.size();
+    int num_vec = num_total / 2;
+
+    MyVec<T> sorted(num_total);
+    std::vector<Future> results;
+    // every stage reads and writes each key of the block once
+    const size_t stage_bytes = 2 * sizeof(T) * num_total;
+
+    if (stream_merge) {
+        StageTimer stage_timer(STAGE_STREAM_MERGE, stage_bytes);
+        kernels::merge(input.data(), num_vec, input.data() + num_vec, num_vec, sorted.data());
+        return sorted;
+    }
+
+    // First do crosswork,
+    // split the sorted subsequences into bitonic subsequences
+    //
+    // launch tasks
+    StageTimer crosswork_timer(STAGE_CROSSWORK, stage_bytes);
+    for (int i = 0; i < num_vec; i++) {
+        T args[] = {input[i], input[num_total-i-1]};
+        TaskLauncher launcher(task_id<T>(SINGLE_SWAP_TASK_ID),
+                              TaskArgument(&args[0], sizeof(T) * 2));
+        Future res = runtime->execute_task(ctx, launcher);
+        results.push_back(res);
+    }
+    // get results
+    for (int i = 0; i < num_vec; i++) {
+        auto values = timed_get_result<MyVec<T>>(results[i]);
+        sorted[i] = values[0];
+        sorted[num_total-i-1] = values[1];
+    }
+    results.clear();
+    crosswork_timer.stop();
+
+    // Then sort each bitonic subsequence,
+    // gaps larger than a leaf block are split into single swaps
+    int gap = num_vec;
+    for (; gap > leaf_size; gap /= 2) {
+        StageTimer stage_timer(STAGE_LARGE_GAP, stage_bytes);
+        // launch tasks
+        for (int lo = 0; lo < num_total; lo += gap) {
+            int half_sz = gap / 2;
+            for (int i = 0; i < half_sz; i++) {
+                T args[] = {sorted[lo+i], sorted[lo+i+half_sz]};
+                TaskLauncher launcher(task_id<T>(SINGLE_SWAP_TASK_ID),
+                                      TaskArgument(&args[0], sizeof(T) * 2));
+                Future res = runtime->execute_task(ctx, launcher);
+                results.push_back(res);
+            }
+        }
+        // get results
+        int j = 0;
+        for (int lo = 0; lo < num_total; lo += gap) {
+            int half_sz = gap / 2;
+            for (int i = 0; i < half_sz; i++) {
+                auto values = timed_get_result<MyVec<T>>(results[j]);
+                sorted[lo+i] = values[0];
+                sorted[lo+i+half_sz] = values[1];
+                j++;
+            }
+        }
+        results.clear();
+    }
+    // and the remaining small gaps are fused into one local SIMD pass
+    {
+        StageTimer stage_timer(STAGE_FUSED_SMALL_GAP,
+                               stage_bytes * kernels::merge_passes<T>(num_total, gap / 2));
+        kernels::bitonic_merge(sorted.data(), num_total, gap / 2);
+    }
+    return sorted;
+}
+
+template<typename T>
+MyVec<T> subsorter_task(const Task *task,
+                        const std::vector<PhysicalRegion> &regions,
+                        Context ctx, Runtime *runtime)
+{
+    TaskTimer timer(task);
+    assert(task->arglen == sizeof(SubsorterArgs));
+    auto args = (const SubsorterArgs *)(task->args);
+    timer.annotate(args->level, args->block);
+    int leaf_size = args->leaf_size;
+
+    // the two sorted inputs, back to back
+    MyVec<T> input;
+    if (args->input_in_region) {
+        Rect<1> rect = runtime->get_index_space_domain(ctx,
+                task->regions[0].region.get_index_space());
+        input.vec.resize(rect.volume());
+        read_block(ctx, runtime, regions[0], block_field(task, 0), input.data());
+    } else {
+        assert(task->futures.size() == 2);
+        Future f1 = task->futures[0];
+        input = timed_get_result<MyVec<T>>(f1);
+        Future f2 = task->futures[1];
+        auto vec2 = timed_get_result<MyVec<T>>(f2);
+        assert(input.size() == vec2.size());
+        input.vec.insert(input.vec.end(), vec2.vec.begin(), vec2.vec.end());
+    }
+
+    MyVec<T> sorted = merge_halves(ctx, runtime, input, leaf_size, args->stream_merge);
+    return finish_subsorter(ctx, runtime, task, regions, sorted);
+}
+// Sort the n keys at `keys` in a recursive sort task, as one leaf block,
+// or by sorting both halves in child tasks and merging them
+template<typename T>
+MyVec<T> sort_block(Context ctx, Runtime *runtime, const RecursiveSortArgs &args,
+                    const T *keys, int n)
+{
+    MyVec<T> sorted;
+    if (n <= args.leaf_size) {
+        // the whole sort fits in a leaf block
+        sorted.vec.assign(keys, keys + n);
+        StageTimer stage_timer(STAGE_LEAF, 2 * sizeof(T) * n * kernels::sort_passes<T>(n));
+        kernels::bitonic_sort(sorted.data(), n);
+        return sorted;
+    }
+    // both halves are launched before either is waited for
+    int num_vec = n / 2;
+    RecursiveSortArgs lower = args;
+    lower.level--;
+    lower.block *= 2;
+    RecursiveSortArgs upper = lower;
+    upper.block++;
+    Future f1 = launch_recursive<T>(ctx, runtime, lower, keys, num_vec);
+    Future f2 = launch_recursive<T>(ctx, runtime, upper, keys + num_vec, num_vec);
+    MyVec<T> input = timed_get_result<MyVec<T>>(f1);
+    auto vec2 = timed_get_result<MyVec<T>>(f2);
+    assert(input.size() == vec2.size());
+    input.vec.insert(input.vec.end(), vec2.vec.begin(), vec2.vec.end());
+    return merge_halves(ctx, runtime, input, args.leaf_size, args.stream_merge);
+}
+
+// Sort a block that is too large for the arguments in place. The halves
+// are sorted in place by child tasks when they are large enough too,
+// otherwise they are passed to the children by value.
+template<typename T>
+void sort_block_in_region(Context ctx, Runtime *runtime, const Task *task,
+                          const RecursiveSortArgs &args)
+{
+    LogicalRegion block = task->regions[0].region;
+    FieldID fid = block_field(task, 0);
+    Rect<1> rect = runtime->get_index_space_domain(ctx, block.get_index_space());
+    int num_total = rect.volume();
+    bool has_output = task->regions.size() == 2;
+    // the children need the block, it is mapped again for the merge
+    runtime->unmap_all_regions(ctx);
+
+    int num_vec = num_total / 2;
+    bool halves_in_region = num_total > args.leaf_size
+        && sizeof(T) * num_vec >= args.region_threshold;
+    if (halves_in_region) {
+        IndexSpace colors = runtime->create_index_space(ctx, Rect<1>(0, 1));
+        IndexPartition ip = runtime->create_equal_partition(ctx, block.get_index_space(), colors);
+        runtime->destroy_index_space(ctx, colors);
+        LogicalPartition halves = runtime->get_logical_partition(ctx, block, ip);
+        RecursiveSortArgs lower = args;
+        lower.level--;
+        lower.block *= 2;
+        RecursiveSortArgs upper = lower;
+        upper.block++;
+        Future f1 = launch_recursive<T>(ctx, runtime, lower, (const T *)NULL, num_vec,
+                runtime->get_logical_subregion_by_color(ctx, halves, DomainPoint(Point<1>(0))),
+                block);
+        Future f2 = launch_recursive<T>(ctx, runtime, upper, (const T *)NULL, num_vec,
+                runtime->get_logical_subregion_by_color(ctx, halves, DomainPoint(Point<1>(1))),
+                block);
+        timed_wait(f1);
+        timed_wait(f2);
+        // every task of the sort partitions its block, so drop the halves
+        runtime->destroy_index_partition(ctx, ip);
+    }
+
+    RegionRequirement req(block, READ_WRITE, EXCLUSIVE, block);
+    req.add_field(fid);
+    PhysicalRegion keys_region = runtime->map_region(ctx, req);
+    {
+        BlockedTimer timer;
+        keys_region.wait_until_valid();
+    }
+    MyVec<T> input(num_total);
+    read_block(ctx, runtime, keys_region, fid, input.data());
+    MyVec<T> sorted = halves_in_region
+        ? merge_halves(ctx, runtime, input, args.leaf_size, args.stream_merge)
+        : sort_block<T>(ctx, runtime, args, input.data(), num_total);
+
+    // the root writes its block to the caller's output region instead
+    if (has_output) {
+        runtime->unmap_region(ctx, keys_region);
+        RegionRequirement out_req(task->regions[1].region, WRITE_DISCARD, EXCLUSIVE,
+                                  task->regions[1].region);
+        out_req.add_field(block_field(task, 1));
+        keys_region = runtime->map_region(ctx, out_req);
+        keys_region.wait_until_valid();
+    }
+    write_block(ctx, runtime, keys_region, has_output ? block_field(task, 1) : fid, sorted.data());
+    runtime->unmap_region(ctx, keys_region);
+}
+
+template<typename T>
+MyVec<T> recursive_sort_task(const Task *task,
+                             const std::vector<PhysicalRegion> &regions,
+                             Context ctx, Runtime *runtime)
+{
+    TaskTimer timer(task);
+    assert(task->arglen >= sizeof(RecursiveSortArgs));
+    RecursiveSortArgs args;
+    memcpy(&args, task->args, sizeof(args));
+    timer.annotate(args.level, args.block);
+    if (args.in_region) {
+        sort_block_in_region<T>(ctx, runtime, task, args);
+        return MyVec<T>();
+    }
+
+    const T *keys = (const T *)((const char *)task->args + sizeof(args));
+    int num_total = (task->arglen - sizeof(args)) / sizeof(T);
+    MyVec<T> sorted = sort_block<T>(ctx, runtime, args, keys, num_total);
+    // the root writes its block to the caller's output region
+    if (regions.size() == 1) {
+        write_block(ctx, runtime, regions[0], block_field(task, 0), sorted.data());
+        return MyVec<T>();
+    }
+    return sorted;
+}
+
+template<typename T>
+MyVec<T> single_swap_task(const Task *task,
+                          const std::vector<PhysicalRegion> &regions,
+                          Context ctx, Runtime *runtime)
+{
+    TaskTimer timer(task);
+    assert(task->arglen == sizeof(T) * 2);
+    auto values = (const T *)(task->args);
+    debug("swap: %lld %lld\n", (long long)values[0], (long long)values[1]);
+    MyVec<T> result {std::min(values[0], values[1]), std::max(values[0], values[1])};
+    return result;
+}
+
+template<typename T>
+MyVec<T> leaf_sort_task(const Task *task,
+                        const std::vector<PhysicalRegion> &regions,
+                        Context ctx, Runtime *runtime)
+{
+    TaskTimer timer(task);
+    assert(task->arglen >= sizeof(LeafSortArgs));
+    LeafSortArgs args;
+    memcpy(&args, task->args, sizeof(args));
+    timer.annotate(0, args.block);
+    size_t key_bytes = task->arglen - sizeof(args);
+    assert(key_bytes % sizeof(T) == 0);
+    int num_total = key_bytes / sizeof(T);
+    MyVec<T> sorted(num_total);
+    memcpy(sorted.data(), (const char *)task->args + sizeof(args), key_bytes);
+    {
+        StageTimer stage_timer(STAGE_LEAF, 2 * key_bytes * kernels::sort_passes<T>(num_total));
+        kernels::bitonic_sort(sorted.data(), num_total);
+    }
+    // large leaf blocks are written to a region instead of the future
+    if (regions.size() == 1) {
+        write_block(ctx, runtime, regions[0], block_field(task, 0), sorted.data());
+        return MyVec<T>();
+    }
+    return sorted;
+}
+
+template<typename T>
+KeyRange min_max_task(const Task *task,
+                      const std::vector<PhysicalRegion> &regions,
+                      Context ctx, Runtime *runtime)
+{
+    TaskTimer timer(task);
+    assert(task->arglen >= sizeof(T) && task->arglen % sizeof(T) == 0);
+    auto values = (const T *)(task->args);
+    auto bounds = std::minmax_element(values, values + task->arglen / sizeof(T));
+    KeyRange range {*bounds.first, *bounds.second};
+    return range;
+}
+
+template<typename T>
+void sort_region_task(const Task *task,
+                      const std::vector<PhysicalRegion> &regions,
+                      Context ctx, Runtime *runtime)
+{
+    TaskTimer timer(task);
+    assert(regions.size() == 1);
+    assert(task->arglen == sizeof(SortRegionArgs));
+    auto args = (const SortRegionArgs *)(task->args);
+
+    Rect<1> rect = runtime->get_index_space_domain(ctx,
+            task->regions[0].region.get_index_space());
+    if (rect.empty()) {
+        return;
+    }
+    // one copy of the keys, with room for the padding sort_keys() adds
+    int num_inputs = rect.volume();
+    int num_total = 1;
+    while (num_total < num_inputs) {
+        num_total *= 2;
+    }
+    std::vector<T> nums;
+    nums.reserve(num_total);
+    nums.resize(num_inputs);
+    read_block(ctx, runtime, regions[0], args->fid, nums.data());
+
+    // the final merge writes the sorted keys back to the field
+    runtime->unmap_all_regions(ctx);
+    sort_values<T>(ctx, runtime, std::move(nums), args->options,
+                   task->regions[0].region, args->fid);
+}
+
+template<typename T>
+void register_key_tasks()
+{
+    {
+        TaskVariantRegistrar registrar(task_id<T>(SUBSORTER_TASK_ID), "subsorter");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        Runtime::preregister_task_variant<MyVec<T>, subsorter_task<T>>(registrar, "subsorter");
+    }
+
+    {
+        TaskVariantRegistrar registrar(task_id<T>(SINGLE_SWAP_TASK_ID), "single_swap");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<MyVec<T>, single_swap_task<T>>(registrar, "single_swap");
+    }
+
+    {
+        TaskVariantRegistrar registrar(task_id<T>(LEAF_SORT_TASK_ID), "leaf_sort");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<MyVec<T>, leaf_sort_task<T>>(registrar, "leaf_sort");
+    }
+
+    {
+        TaskVariantRegistrar registrar(task_id<T>(MIN_MAX_TASK_ID), "min_max");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<KeyRange, min_max_task<T>>(registrar, "min_max");
+    }
+
+    {
+        TaskVariantRegistrar registrar(task_id<T>(RECURSIVE_SORT_TASK_ID), "recursive_sort");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        Runtime::preregister_task_variant<MyVec<T>, recursive_sort_task<T>>(registrar, "recursive_sort");
+    }
+
+    {
+        TaskVariantRegistrar registrar(task_id<T>(SORT_REGION_TASK_ID), "sort_region");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        Runtime::preregister_task_variant<sort_region_task<T>>(registrar, "sort_region");
+    }
+}
+
+void register_tasks(TaskID base)
+{
+    task_id_base = base;
+    register_key_tasks<int>();
+    register_key_tasks<int16_t>();
+    register_key_tasks<uint16_t>();
+    register_key_tasks<uint8_t>();
+    register_search_tasks(task_id_base + SEARCH_INDEX_TASK_ID);
+    register_permute_tasks(task_id_base + PERMUTE_TASK_ID);
+    register_shard_tasks(task_id_base + SHARD_TASK_ID);
+}
+
+Future sort(Context ctx, Runtime *runtime,
+            LogicalRegion region, FieldID fid, const SortOptions &options,
+            LogicalRegion parent)
+{
+    SortRegionArgs args {options, fid};
+    TaskID base;
+    switch (options.key_type) {
+    case KEY_INT16:
+        base = task_id<int16_t>(SORT_REGION_TASK_ID);
+        break;
+    case KEY_UINT16:
+        base = task_id<uint16_t>(SORT_REGION_TASK_ID);
+        break;
+    case KEY_UINT8:
+        base = task_id<uint8_t>(SORT_REGION_TASK_ID);
+        break;
+    default:
+        base = task_id<int>(SORT_REGION_TASK_ID);
+        break;
+    }
+    TaskLauncher launcher(base, TaskArgument(&args, sizeof(args)));
+    launcher.add_region_requirement(
+            RegionRequirement(region, READ_WRITE, EXCLUSIVE,
+                              parent.exists() ? parent : region));
+    launcher.region_requirements[0].add_field(fid);
+    return runtime->execute_task(ctx, launcher);
+}
+
+template MyVec<int> sort_values<int>(Context, Runtime *,
+        std::vector<int>, const SortOptions &, LogicalRegion, FieldID);
+template MyVec<int16_t> sort_values<int16_t>(Context, Runtime *,
+        std::vector<int16_t>, const SortOptions &, LogicalRegion, FieldID);
+template MyVec<uint16_t> sort_values<uint16_t>(Context, Runtime *,
+        std::vector<uint16_t>, const SortOptions &, LogicalRegion, FieldID);
+template MyVec<uint8_t> sort_values<uint8_t>(Context, Runtime *,
+        std::vector<uint8_t>, const SortOptions &, LogicalRegion, FieldID);
+
+} // namespace bitonic
+
@@ -0,0 +1,169 @@
+// Bitonic sorter library
+// Sorts keys with Legion tasks, either as values passed through futures
+// or as a field of a logical region owned by the caller.
+
+#ifndef BITONIC_H
+#define BITONIC_H
+
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <limits>
+#include <type_traits>
+#include <vector>
+#include "legion.h"
+
+#if DEBUG == 1
+    #define debug(...) fprintf(stderr, __VA_ARGS__)
+#else
+    #define debug(...) 0
+#endif
+
+namespace bitonic {
+
+enum KeyType {
+    KEY_INT,
+    KEY_INT16,
+    KEY_UINT16,
+    KEY_UINT8,
+    NUM_KEY_TYPES,
+};
+
+template<typename T> struct KeyTraits;
+template<> struct KeyTraits<int> {
+    static constexpr KeyType type = KEY_INT;
+    static constexpr const char *name = "int";
+};
+template<> struct KeyTraits<int16_t> {
+    static constexpr KeyType type = KEY_INT16;
+    static constexpr const char *name = "i16";
+};
+template<> struct KeyTraits<uint16_t> {
+    static constexpr KeyType type = KEY_UINT16;
+    static constexpr const char *name = "u16";
+};
+template<> struct KeyTraits<uint8_t> {
+    static constexpr KeyType type = KEY_UINT8;
+    static constexpr const char *name = "u8";
+};
+
+// Default number of keys sorted by one leaf task
+const int DEFAULT_LEAF_SIZE = 1024;
+
+// Sorted blocks of at least this many bytes are passed between
+// tasks through regions instead of futures
+const size_t DEFAULT_REGION_THRESHOLD = 1 << 20;
+
+// Library tasks take the task ids starting from here,
+// applications may move them with register_tasks()
+const Legion::TaskID DEFAULT_TASK_ID_BASE = 10000;
+
+struct SortOptions {
+    KeyType key_type = KEY_INT;
+    int leaf_size = DEFAULT_LEAF_SIZE;
+    // rebase keys into a narrower type when their range allows it
+    bool compress = false;
+    // merge the two sorted inputs of a subsorter with the local SIMD
+    // streaming merge instead of swap tasks and compare-exchange stages
+    bool stream_merge = false;
+    // each merge task launches the sorts of its two halves itself,
+    // instead of the caller launching the tasks of every level
+    bool recursive = false;
+    size_t region_threshold = DEFAULT_REGION_THRESHOLD;
+};
+
+template<typename T>
+struct MyVec {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "MyVec serializes elements with memcpy");
+    std::vector<T> vec;
+
+    MyVec(size_t sz = 0): vec(sz) {}
+    MyVec(std::initializer_list<T> l): vec(l) {}
+    size_t size() const { return vec.size(); }
+    T& operator[](int i) { return vec[i]; }
+    const T& operator[](int i) const { return vec[i]; }
+    T *data() { return vec.data(); }
+    const T *data() const { return vec.data(); }
+    void append(const T& e) { vec.push_back(e); }
+
+    // elements are packed back to back, so narrow keys
+    // take 1 or 2 bytes each in the serialized buffer
+    size_t legion_buffer_size(void) const {
+        size_t result = sizeof(size_t) + sizeof(T) * vec.size();
+        debug("buffer size: %zu", result);
+        return result;
+    }
+
+    size_t legion_serialize(void *buffer) const {
+        char *target = (char *)buffer;
+        size_t length = vec.size();
+        memcpy(target, &length, sizeof(size_t));
+        target += sizeof(size_t);
+        memcpy(target, vec.data(), sizeof(T) * length);
+        target += sizeof(T) * length;
+        debug("finish serializing");
+        return (size_t)target - (size_t)buffer;
+    }
+
+    size_t legion_deserialize(const void *buffer) {
+        const char *source = (const char *)buffer;
+        size_t length;
+        memcpy(&length, source, sizeof(size_t));
+        source += sizeof(size_t);
+        vec.resize(length);
+        memcpy(vec.data(), source, sizeof(T) * length);
+        source += sizeof(T) * length;
+        debug("finish deserializing");
+        return (size_t)source - (size_t)buffer;
+    }
+};
+
+// padding values are shown as '#', narrow keys may legitimately
+// hold the max value, so callers printing real inputs disable it
+template<typename T>
+void print_keys(const T *keys, int start, int end, bool show_padding = true) {
+    for (int i = start; i < end; i++) {
+        if (show_padding && keys[i] == std::numeric_limits<T>::max()) {
+            printf("# ");
+        } else {
+            printf("%lld ", (long long)keys[i]);
+        }
+    }
+    printf("\n");
+}
+
+template<typename T>
+void print_myvec(const MyVec<T> &sorted, int start, int end, bool show_padding = true) {
+    print_keys(sorted.data(), start, end, show_padding);
+}
+
+// Register the sorter tasks, must be called before Runtime::start().
+void register_tasks(Legion::TaskID task_id_base = DEFAULT_TASK_ID_BASE);
+
+// Sort a 1-D field of `region` in place. The field holds keys of
+// `options.key_type`, and the returned future completes with the sort.
+// `parent` is the region the caller has privileges on, `region` itself
+// by default.
+Legion::Future sort(Legion::Context ctx, Legion::Runtime *runtime,
+                    Legion::LogicalRegion region, Legion::FieldID fid,
+                    const SortOptions &options = SortOptions(),
+                    Legion::LogicalRegion parent = Legion::LogicalRegion::NO_REGION);
+
+// Sort keys passed by value, the result is padded
+// with max values up to a power of 2. With an `output` region, the
+// sorted keys are written to its field instead, without the padding,
+// and an empty vector is returned. No keys give an empty vector too.
+// Callers done with the keys can move them in to save a copy.
+// Instantiated for int, int16_t, uint16_t and uint8_t.
+template<typename T>
+MyVec<T> sort_values(Legion::Context ctx, Legion::Runtime *runtime,
+                     std::vector<T> nums, const SortOptions &options,
+                     Legion::LogicalRegion output = Legion::LogicalRegion::NO_REGION,
+                     Legion::FieldID output_fid = 0);
+
+} // namespace bitonic
+
+#endif // BITONIC_H
@@ -0,0 +1,110 @@
+// C API of the bitonic sorter
+// The runtime runs in the background, and the calling thread
+// becomes an implicit top-level task that launches the sorts.
+
+#include <cassert>
+#include <climits>
+#include "bitonic.h"
+#include "bitonic_c.h"
+
+using namespace Legion;
+
+enum {
+    C_API_TASK_ID = bitonic::DEFAULT_TASK_ID_BASE - 1,
+};
+
+enum {
+    FID_KEY,
+};
+
+static Runtime *c_runtime = NULL;
+static Context c_ctx;
+
+void bitonic_options_init(bitonic_options_t *opts)
+{
+    bitonic::SortOptions defaults;
+    opts->leaf_size = defaults.leaf_size;
+    opts->compress = defaults.compress;
+    opts->stream_merge = defaults.stream_merge;
+    opts->recursive = defaults.recursive;
+}
+
+int bitonic_init(int argc, char **argv)
+{
+    if (c_runtime != NULL) {
+        return BITONIC_ERR_ALREADY_INITIALIZED;
+    }
+    bitonic::register_tasks();
+    if (Runtime::start(argc, argv, true /*background*/) != 0) {
+        return BITONIC_ERR_START_FAILED;
+    }
+    c_runtime = Runtime::get_runtime();
+    c_ctx = c_runtime->begin_implicit_task(C_API_TASK_ID, 0 /*default mapper*/,
+                                           Processor::LOC_PROC, "bitonic_c_api",
+                                           false /*control replicable*/);
+    return BITONIC_OK;
+}
+
+int bitonic_sort_i32(int32_t *ptr, size_t n, const bitonic_options_t *opts)
+{
+    if (c_runtime == NULL) {
+        return BITONIC_ERR_NOT_INITIALIZED;
+    }
+    // the sorter pads inputs to the next power of 2 in an int
+    if (n > (size_t)INT_MAX / 2 + 1) {
+        return BITONIC_ERR_TOO_LARGE;
+    }
+    // leaf blocks must evenly divide the padded input
+    if (opts != NULL && (opts->leaf_size <= 0 || (opts->leaf_size & (opts->leaf_size - 1)) != 0)) {
+        return BITONIC_ERR_INVALID_ARGUMENT;
+    }
+    if (n == 0) {
+        return BITONIC_OK;
+    }
+
+    bitonic::SortOptions options;
+    options.key_type = bitonic::KEY_INT;
+    if (opts != NULL) {
+        options.leaf_size = opts->leaf_size;
+        options.compress = opts->compress != 0;
+        options.stream_merge = opts->stream_merge != 0;
+        options.recursive = opts->recursive != 0;
+    }
+
+    Runtime *runtime = c_runtime;
+    Context ctx = c_ctx;
+    IndexSpace is = runtime->create_index_space(ctx, Rect<1>(0, n - 1));
+    FieldSpace fs = runtime->create_field_space(ctx);
+    {
+        FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
+        allocator.allocate_field(sizeof(int32_t), FID_KEY);
+    }
+    LogicalRegion region = runtime->create_logical_region(ctx, is, fs);
+
+    // attach the caller's buffer as the instance of the key field
+    Memory sysmem = Machine::MemoryQuery(Machine::get_machine())
+            .only_kind(Memory::SYSTEM_MEM).first();
+    assert(sysmem.exists());
+    AttachLauncher attacher(LEGION_EXTERNAL_INSTANCE, region, region);
+    std::vector<FieldID> fields {FID_KEY};
+    attacher.attach_array_soa(ptr, false /*column major*/, fields, sysmem);
+    PhysicalRegion attached = runtime->attach_external_resource(ctx, attacher);
+
+    bitonic::sort(ctx, runtime, region, FID_KEY, options).get_void_result();
+
+    runtime->detach_external_resource(ctx, attached).get_void_result();
+    runtime->destroy_logical_region(ctx, region);
+    runtime->destroy_field_space(ctx, fs);
+    runtime->destroy_index_space(ctx, is);
+    return BITONIC_OK;
+}
+
+int bitonic_shutdown(void)
+{
+    if (c_runtime == NULL) {
+        return BITONIC_ERR_NOT_INITIALIZED;
+    }
+    c_runtime->finish_implicit_task(c_ctx);
+    c_runtime = NULL;
+    return Runtime::wait_for_shutdown();
+}
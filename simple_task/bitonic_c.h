@@ -0,0 +1,53 @@
+/* C API of the bitonic sorter
+ * Lets applications that do not use Legion sort their own memory in place.
+ * bitonic_init() starts the Legion runtime in the background, and the sort
+ * calls attach the caller's buffer as an external instance, so the keys are
+ * not staged through files or copied into a separate process.
+ * All calls must be made from the thread that called bitonic_init().
+ */
+
+#ifndef BITONIC_C_H
+#define BITONIC_C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+    BITONIC_OK = 0,
+    BITONIC_ERR_NOT_INITIALIZED,
+    BITONIC_ERR_ALREADY_INITIALIZED,
+    BITONIC_ERR_TOO_LARGE,
+    BITONIC_ERR_INVALID_ARGUMENT,
+    BITONIC_ERR_START_FAILED,
+};
+
+typedef struct bitonic_options_t {
+    int leaf_size;  /* keys per leaf task, a power of 2 */
+    int compress;   /* rebase keys into a narrower type when possible */
+    int stream_merge;   /* merge sorted blocks with the SIMD streaming merge */
+    int recursive;      /* merge tasks launch the sorts of their halves */
+} bitonic_options_t;
+
+/* Fill in the default options */
+void bitonic_options_init(bitonic_options_t *opts);
+
+/* Start the Legion runtime, argv may hold Legion flags such as -ll:cpu.
+ * BITONIC_ERR_START_FAILED if the runtime did not start. */
+int bitonic_init(int argc, char **argv);
+
+/* Sort n keys at ptr in place, opts may be NULL for the defaults.
+ * A leaf size that is not a positive power of 2 is an invalid argument. */
+int bitonic_sort_i32(int32_t *ptr, size_t n, const bitonic_options_t *opts);
+
+/* Wait for outstanding work and stop the runtime */
+int bitonic_shutdown(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BITONIC_C_H */
@@ -0,0 +1,379 @@
+// SIMD bitonic kernels for sorting small blocks in place
+// The kernels use GCC vector extensions sized to one AVX-512 register, so
+// narrow keys get more lanes: 16 for int, 32 for int16_t/uint16_t and 64 for
+// uint8_t. Without AVX-512 the compiler splits each vector into narrower ones.
+
+#ifndef BITONIC_KERNELS_H
+#define BITONIC_KERNELS_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+namespace kernels {
+
+constexpr size_t SIMD_BYTES = 64;
+
+template<typename T>
+struct Simd {
+    static_assert(std::is_integral<T>::value, "keys must be integers");
+    static constexpr size_t lanes = SIMD_BYTES / sizeof(T);
+    typedef T vec __attribute__((vector_size(SIMD_BYTES)));
+    // shuffle indices must be integers of the same width as the keys
+    typedef typename std::make_unsigned<T>::type index_t;
+    typedef index_t index_vec __attribute__((vector_size(SIMD_BYTES)));
+
+    static vec load(const T *p) {
+        vec v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+    static void store(T *p, vec v) { memcpy(p, &v, sizeof(v)); }
+
+    static index_vec iota() {
+        index_vec idx;
+        for (size_t i = 0; i < lanes; i++) {
+            idx[i] = i;
+        }
+        return idx;
+    }
+    static vec reverse(vec v) {
+        return __builtin_shuffle(v, (index_t)(lanes - 1) - iota());
+    }
+    static vec min(vec a, vec b) { return a < b ? a : b; }
+    static vec max(vec a, vec b) { return a < b ? b : a; }
+
+    // compare each lane with lane ^ `partner_xor`, keeping the max
+    // in lanes whose `upper_bit` is set and the min in the others
+    static vec exchange(vec v, size_t partner_xor, size_t upper_bit) {
+        index_vec idx = iota();
+        vec p = __builtin_shuffle(v, (index_vec)(idx ^ (index_t)partner_xor));
+        return (idx & (index_t)upper_bit) != 0 ? max(v, p) : min(v, p);
+    }
+};
+
+template<typename T>
+inline void compare_exchange(T &x, T &y) {
+    if (y < x) {
+        std::swap(x, y);
+    }
+}
+
+// Compare-exchange pairs (lo + i, lo + 2 * half - 1 - i) of each block of
+// 2 * half elements. This turns two sorted halves into a bitonic sequence
+// whose lower half holds the smaller values.
+template<typename T>
+void flip(T *a, size_t n, size_t half) {
+    typedef Simd<T> S;
+    if (half >= S::lanes && n % S::lanes == 0) {
+        for (size_t lo = 0; lo < n; lo += 2 * half) {
+            for (size_t i = 0; i < half; i += S::lanes) {
+                T *x = a + lo + i;
+                T *y = a + lo + 2 * half - S::lanes - i;
+                auto vx = S::load(x);
+                auto vy = S::reverse(S::load(y));
+                S::store(x, S::min(vx, vy));
+                S::store(y, S::reverse(S::max(vx, vy)));
+            }
+        }
+    } else if (n % S::lanes == 0) {
+        for (size_t lo = 0; lo < n; lo += S::lanes) {
+            S::store(a + lo, S::exchange(S::load(a + lo), 2 * half - 1, half));
+        }
+    } else {
+        for (size_t lo = 0; lo < n; lo += 2 * half) {
+            for (size_t i = 0; i < half; i++) {
+                compare_exchange(a[lo + i], a[lo + 2 * half - 1 - i]);
+            }
+        }
+    }
+}
+
+// Compare-exchange pairs (lo + i, lo + i + half) of each block of 2 * half
+// elements, the half-cleaner step of a bitonic merge.
+template<typename T>
+void half_clean(T *a, size_t n, size_t half) {
+    typedef Simd<T> S;
+    if (half >= S::lanes && n % S::lanes == 0) {
+        for (size_t lo = 0; lo < n; lo += 2 * half) {
+            for (size_t i = 0; i < half; i += S::lanes) {
+                T *x = a + lo + i;
+                T *y = x + half;
+                auto vx = S::load(x);
+                auto vy = S::load(y);
+                S::store(x, S::min(vx, vy));
+                S::store(y, S::max(vx, vy));
+            }
+        }
+    } else {
+        for (size_t lo = 0; lo < n; lo += 2 * half) {
+            for (size_t i = 0; i < half; i++) {
+                compare_exchange(a[lo + i], a[lo + i + half]);
+            }
+        }
+    }
+}
+
+// Blocks of keys that a merge finishes in the cache once its gap is small
+// enough. Larger gaps make every stage a pass over memory, those are done
+// three stages per pass.
+constexpr size_t CACHE_BLOCK_BYTES = 256 << 10;
+
+// The half-cleaner stages half, half / 2 and half / 4 in one pass. The
+// keys at the 8 offsets lo + i + k * half / 4 only meet each other in
+// these stages, so they are loaded together, exchanged in registers and
+// stored once. The 8 streams also keep more misses in flight than the 2
+// of a single stage.
+template<typename T>
+void half_clean3(T *a, size_t n, size_t half) {
+    typedef Simd<T> S;
+    const size_t eighth = half / 4;
+    for (size_t lo = 0; lo < n; lo += 2 * half) {
+        for (size_t i = 0; i < eighth; i += S::lanes) {
+            T *p = a + lo + i;
+            typename S::vec v[8];
+            for (int k = 0; k < 8; k++) {
+                v[k] = S::load(p + k * eighth);
+            }
+            for (int d = 4; d >= 1; d /= 2) {
+                for (int k = 0; k < 8; k++) {
+                    if ((k & d) == 0) {
+                        auto smaller = S::min(v[k], v[k + d]);
+                        v[k + d] = S::max(v[k], v[k + d]);
+                        v[k] = smaller;
+                    }
+                }
+            }
+            for (int k = 0; k < 8; k++) {
+                S::store(p + k * eighth, v[k]);
+            }
+        }
+    }
+}
+
+// Whether bitonic_merge() runs the stages from `half` with half_clean3()
+template<typename T>
+bool use_half_clean3(size_t n, size_t half) {
+    typedef Simd<T> S;
+    return 2 * half * sizeof(T) > CACHE_BLOCK_BYTES && half / 4 >= S::lanes
+        && n % S::lanes == 0;
+}
+
+// Run the half-cleaner stages half, half / 2, ..., 1 over n elements.
+// Once the gap fits in a register, the remaining stages of each vector are
+// fused so that it is loaded and stored only once.
+template<typename T>
+void bitonic_merge(T *a, size_t n, size_t half) {
+    typedef Simd<T> S;
+    for (; use_half_clean3<T>(n, half); half /= 8) {
+        half_clean3(a, n, half);
+    }
+    // the stages left stay inside blocks of 2 * half keys,
+    // so each block is finished while it is in the cache
+    if (half >= S::lanes && 2 * half < n && n % S::lanes == 0) {
+        for (size_t lo = 0; lo < n; lo += 2 * half) {
+            bitonic_merge(a + lo, 2 * half, half);
+        }
+        return;
+    }
+    for (; half >= S::lanes; half /= 2) {
+        half_clean(a, n, half);
+    }
+    if (half == 0) {
+        return;
+    }
+    if (n % S::lanes == 0) {
+        for (size_t lo = 0; lo < n; lo += S::lanes) {
+            auto v = S::load(a + lo);
+            for (size_t h = half; h >= 1; h /= 2) {
+                v = S::exchange(v, h, h);
+            }
+            S::store(a + lo, v);
+        }
+    } else {
+        for (; half >= 1; half /= 2) {
+            half_clean(a, n, half);
+        }
+    }
+}
+
+// Sort n elements in place, n must be a power of two.
+template<typename T>
+void bitonic_sort(T *a, size_t n) {
+    typedef Simd<T> S;
+    // the stages of the first blocks stay inside a cache block,
+    // which ends sorted like any block of the sort
+    size_t block = CACHE_BLOCK_BYTES / sizeof(T);
+    size_t start = 1;
+    if (n > block && n % S::lanes == 0) {
+        for (size_t lo = 0; lo < n; lo += block) {
+            bitonic_sort(a + lo, block);
+        }
+        start = block;
+    }
+    for (size_t half = start; half < n; half *= 2) {
+        flip(a, n, half);
+        bitonic_merge(a, n, half / 2);
+    }
+}
+
+// Merge two sorted vectors in registers,
+// x gets the smaller half of their keys and y the larger, both sorted.
+template<typename T>
+inline void merge_vectors(typename Simd<T>::vec &x, typename Simd<T>::vec &y) {
+    typedef Simd<T> S;
+    auto r = S::reverse(y);
+    auto lo = S::min(x, r);
+    auto hi = S::max(x, r);
+    // both halves are bitonic, finish them with the in-register stages
+    for (size_t h = S::lanes / 2; h >= 1; h /= 2) {
+        lo = S::exchange(lo, h, h);
+        hi = S::exchange(hi, h, h);
+    }
+    x = lo;
+    y = hi;
+}
+
+// Merge the sorted arrays a and b of na and nb keys into out.
+// One vector of keys is loaded at a time from the input whose next key is
+// smaller and merged in registers with the largest keys seen so far, the
+// smaller half of the result is final. Each key is read and written once.
+template<typename T>
+void merge(const T *a, size_t na, const T *b, size_t nb, T *out) {
+    typedef Simd<T> S;
+    if (na % S::lanes != 0 || nb % S::lanes != 0 || na == 0 || nb == 0) {
+        std::merge(a, a + na, b, b + nb, out);
+        return;
+    }
+    auto x = S::load(a);
+    auto y = S::load(b);
+    size_t i = S::lanes, j = S::lanes;
+    merge_vectors<T>(x, y);
+    S::store(out, x);
+    out += S::lanes;
+    while (i < na || j < nb) {
+        if (j == nb || (i < na && a[i] <= b[j])) {
+            x = S::load(a + i);
+            i += S::lanes;
+        } else {
+            x = S::load(b + j);
+            j += S::lanes;
+        }
+        merge_vectors<T>(x, y);
+        S::store(out, x);
+        out += S::lanes;
+    }
+    S::store(out, y);
+}
+
+// Segments of up to this many keys are sorted by sort_tiny_segments()
+constexpr size_t MAX_TINY_SEGMENT = 16;
+
+// Sort the m keys of each lane held across the vectors v[0..m), m a power
+// of two. This is bitonic_sort() with vectors in place of keys, so every
+// comparator is one min and one max over all the lanes.
+template<typename T>
+void sort_lanes(typename Simd<T>::vec *v, size_t m) {
+    typedef Simd<T> S;
+    for (size_t half = 1; half < m; half *= 2) {
+        for (size_t lo = 0; lo < m; lo += 2 * half) {
+            for (size_t i = 0; i < half; i++) {
+                auto &x = v[lo + i];
+                auto &y = v[lo + 2 * half - 1 - i];
+                auto smaller = S::min(x, y);
+                y = S::max(x, y);
+                x = smaller;
+            }
+        }
+        for (size_t h = half / 2; h >= 1; h /= 2) {
+            for (size_t lo = 0; lo < m; lo += 2 * h) {
+                for (size_t i = lo; i < lo + h; i++) {
+                    auto smaller = S::min(v[i], v[i + h]);
+                    v[i + h] = S::max(v[i], v[i + h]);
+                    v[i] = smaller;
+                }
+            }
+        }
+    }
+}
+
+// Sort each segment [starts[i], starts[i + 1]) of a, for num_segments
+// segments of at most MAX_TINY_SEGMENT keys. One segment is loaded into
+// each lane, so that key k of the segment is lane s of vector k, padded
+// with max values, and one pass of the network sorts a segment per lane.
+// The network is sized for the longest segment of the pass.
+template<typename T>
+void sort_tiny_segments(T *a, const int *starts, size_t num_segments) {
+    typedef Simd<T> S;
+    // key k of the segment in lane s is rows[k][s]
+    T rows[MAX_TINY_SEGMENT][S::lanes];
+    typename S::vec v[MAX_TINY_SEGMENT];
+    for (size_t first = 0; first < num_segments; first += S::lanes) {
+        size_t count = std::min(S::lanes, num_segments - first);
+        const int *start = starts + first;
+        size_t longest = 1;
+        for (size_t s = 0; s < count; s++) {
+            longest = std::max(longest, (size_t)(start[s + 1] - start[s]));
+        }
+        size_t m = 1;
+        while (m < longest) {
+            m *= 2;
+        }
+        // m may be MAX_TINY_SEGMENT, so the end is counted from rows[0]
+        std::fill(&rows[0][0], &rows[0][0] + m * S::lanes, std::numeric_limits<T>::max());
+        for (size_t s = 0; s < count; s++) {
+            for (int k = 0; k < start[s + 1] - start[s]; k++) {
+                rows[k][s] = a[start[s] + k];
+            }
+        }
+        for (size_t k = 0; k < m; k++) {
+            v[k] = S::load(rows[k]);
+        }
+        sort_lanes<T>(v, m);
+        for (size_t k = 0; k < m; k++) {
+            S::store(rows[k], v[k]);
+        }
+        for (size_t s = 0; s < count; s++) {
+            for (int k = 0; k < start[s + 1] - start[s]; k++) {
+                a[start[s] + k] = rows[k][s];
+            }
+        }
+    }
+}
+
+// Number of passes over the n keys made by bitonic_merge(a, n, half)
+template<typename T>
+size_t merge_passes(size_t n, size_t half) {
+    typedef Simd<T> S;
+    size_t passes = 0;
+    for (; use_half_clean3<T>(n, half); half /= 8) {
+        passes++;
+    }
+    for (; half >= S::lanes; half /= 2) {
+        passes++;
+    }
+    for (; half >= 1; half /= 2) {
+        passes++;
+        // fused into a single pass when the vector path applies
+        if (n % S::lanes == 0) {
+            break;
+        }
+    }
+    return passes;
+}
+
+// Number of passes over the n keys made by bitonic_sort(a, n)
+template<typename T>
+size_t sort_passes(size_t n) {
+    size_t passes = 0;
+    for (size_t half = 1; half < n; half *= 2) {
+        passes += 1 + merge_passes<T>(n, half / 2);
+    }
+    return passes;
+}
+
+} // namespace kernels
+
+#endif // BITONIC_KERNELS_H
@@ -2,231 +2,910 @@
 // The algorithm is described here https://en.wikipedia.org/wiki/Bitonic_sorter
 // Author: dongyan (Andy)
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
-#include <initializer_list>
+#include <memory>
+#include <random>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "legion.h"
-
-#if DEBUG == 1
-    #define debug(...) fprintf(stderr, __VA_ARGS__)
-#else
-    #define debug(...) 0
-#endif
+#include "arrow_file.h"
+#include "bitonic.h"
+#include "bitonic_kernels.h"
+#include "external.h"
+#include "hdf5_file.h"
+#include "io.h"
+#include "permute.h"
+#include "search.h"
+#include "shards.h"
+#include "simulate.h"
+#include "sorted_file.h"
+#include "stats.h"
+#include "trace.h"
+#include "tune.h"
 
 using namespace Legion;
+using namespace bitonic;
 
 enum {
     TOP_LEVEL_TASK_ID,
-    SUBSORTER_TASK_ID,
-    SINGLE_SWAP_TASK_ID,
 };
 
+enum {
+    FID_KEY,
+    FID_DEST,
+    // payload columns take the field ids from here on
+    FID_PAYLOAD,
+};
+
+enum Distribution {
+    DIST_UNIFORM,
+    DIST_SORTED,
+    DIST_REVERSE,
+    // 16 distinct values
+    DIST_FEW,
+};
+
+// Options of the executable on top of the library's SortOptions
+struct RunConfig {
+    std::vector<long long> inputs;
+    // generate this many keys instead of taking them from the command line
+    long long num_generated = 0;
+    Distribution dist = DIST_UNIFORM;
+    unsigned long long seed = 1;
+    // report the order of the result instead of printing it
+    bool quiet = false;
+    // raw keys of the key type are read from and written to these files,
+    // or HDF5 datasets given as file.h5:/dataset, or Arrow IPC columns
+    // given as file.arrow[:column]. The input may also be several raw
+    // files, given as a glob pattern or as @manifest
+    const char *input_file = NULL;
+    const char *output_file = NULL;
+    IoOptions io;
+    OutputOptions output;
+    // look up the keys in this indexed file instead of sorting them
+    const char *lookup_file = NULL;
+    // sort the keys in segments of 1 to this many keys instead
+    int max_segment = 0;
+    // random lower_bound queries run against the sorted keys
+    int search_queries = 0;
+    // payload columns reordered with the keys, and the bytes of each row
+    int payload_columns = 0;
+    size_t payload_bytes = 8;
+    // sort the input file in runs that are spilled and merged
+    bool external = false;
+    ExternalOptions external_options;
+    // sort externally when the in-memory sort is estimated to need more
+    // bytes than this, 0 for no limit
+    long long mem_budget = 0;
+};
+
+template<typename T>
+T generate_key(const RunConfig &config, long long i, std::mt19937_64 &rng)
+{
+    const long long lo = std::numeric_limits<T>::min();
+    const long long hi = std::numeric_limits<T>::max();
+    const long long n = config.num_generated;
+    switch (config.dist) {
+    case DIST_SORTED:
+        return (T)(lo + (hi - lo) / n * i);
+    case DIST_REVERSE:
+        return (T)(hi - (hi - lo) / n * i);
+    case DIST_FEW:
+        return (T)(lo + (hi - lo) / 16 * (long long)(rng() % 16));
+    default:
+        return (T)std::uniform_int_distribution<long long>(lo, hi)(rng);
+    }
+}
+
+template<typename T>
+void run_external(Context ctx, Runtime *runtime,
+                  const RunConfig &config, const SortOptions &options)
+{
+    // runs are read from and merged into raw key files
+    std::string file, dataset;
+    assert(!parse_hdf5_path(config.input_file, file, dataset));
+    assert(!parse_arrow_path(config.input_file, file, dataset));
+    assert(config.output_file == NULL || !parse_hdf5_path(config.output_file, file, dataset));
+    assert(config.output_file == NULL || !parse_arrow_path(config.output_file, file, dataset));
+    printf("Running external bitonic sorter for the %s keys of %s...\n",
+           KeyTraits<T>::name, config.input_file);
+    ExternalOptions external = config.external_options;
+    external.io = config.io;
+    external.output = config.output;
+    auto start = std::chrono::steady_clock::now();
+    auto stats = sort_file<T>(ctx, runtime, config.input_file, config.output_file,
+                              options, external);
+    auto end = std::chrono::steady_clock::now();
+
+    double ms = std::chrono::duration<double, std::milli>(end - start).count();
+    printf("sort time: %.3f ms, %.3f Mkeys/s\n", ms, stats.num_keys / ms * 1e-3);
+    print_external_stats(stats);
+    printf("sorting results: %lld keys %s\n", stats.num_keys,
+           stats.in_order ? "in order" : "OUT OF ORDER");
+}
+
+// Build a search index over the sorted keys and compare
+// batched queries against std::lower_bound on the sorted array
+template<typename T>
+void run_search(Context ctx, Runtime *runtime, LogicalRegion sorted_region,
+                const T *sorted, int num_keys, const RunConfig &config)
+{
+    auto start = std::chrono::steady_clock::now();
+    SearchIndex<T> index;
+    index.build(ctx, runtime, sorted_region, FID_KEY, num_keys);
+    auto end = std::chrono::steady_clock::now();
+    double build_ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+    std::mt19937_64 rng(config.seed + 1);
+    std::uniform_int_distribution<long long> dist(std::numeric_limits<T>::min(),
+                                                  std::numeric_limits<T>::max());
+    std::vector<T> queries(config.search_queries);
+    for (auto &query : queries) {
+        query = (T)dist(rng);
+    }
+    std::vector<int> expected(queries.size()), positions(queries.size());
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < queries.size(); i++) {
+        expected[i] = std::lower_bound(sorted, sorted + num_keys, queries[i]) - sorted;
+    }
+    end = std::chrono::steady_clock::now();
+    double flat_ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+    start = std::chrono::steady_clock::now();
+    index.lower_bound_batch(queries.data(), queries.size(), positions.data());
+    end = std::chrono::steady_clock::now();
+    double batch_ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+    printf("search index: built in %.3f ms, %d queries: std::lower_bound %.3f ms, "
+           "batched %.3f ms (%.2fx), results %s\n",
+           build_ms, config.search_queries, flat_ms, batch_ms, flat_ms / batch_ms,
+           positions == expected ? "match" : "DIFFER");
+}
+
+template<typename T>
+void run_lookup(const RunConfig &config)
+{
+    SortedFileReader<T> file(config.lookup_file);
+    printf("Looking up %zu keys in the %llu %s keys of %s...\n", config.inputs.size(),
+           (unsigned long long)file.size(), KeyTraits<T>::name, config.lookup_file);
+    for (long long key : config.inputs) {
+        assert(key >= std::numeric_limits<T>::min());
+        assert(key <= std::numeric_limits<T>::max());
+        printf("lower bound of %lld: %llu\n", key,
+               (unsigned long long)file.lower_bound((T)key));
+    }
+    printf("blocks read: %zu of %zu\n", file.blocks_read(), file.block_index().size());
+}
+
+// Split the keys into segments of random lengths and sort every segment,
+// comparing the sort of one segment per SIMD lane with std::sort
 template<typename T>
-struct MyVec {
-    std::vector<T> vec;
-
-    MyVec(size_t sz = 0): vec(sz) {}
-    MyVec(std::initializer_list<T> l): vec(l) {}
-    size_t size() const { return vec.size(); }
-    T& operator[](int i) { return vec[i]; }
-    const T& operator[](int i) const { return vec[i]; }
-    void append(const T& e) { vec.push_back(e); }
-
-    size_t legion_buffer_size(void) const {
-        size_t result = sizeof(size_t);
-        for (const auto &e : vec) {
-            result += sizeof(e);
+void run_segments(const RunConfig &config)
+{
+    std::mt19937_64 rng(config.seed);
+    std::vector<T> keys;
+    if (config.num_generated > 0) {
+        keys.resize(config.num_generated);
+        for (long long i = 0; i < config.num_generated; i++) {
+            keys[i] = generate_key<T>(config, i, rng);
+        }
+    } else {
+        for (long long key : config.inputs) {
+            keys.push_back((T)key);
         }
-        debug("buffer size: %zu", result);
-        return result;
     }
+    std::mt19937_64 lengths(config.seed + 2);
+    std::vector<int> starts {0};
+    while (starts.back() < (int)keys.size()) {
+        int length = 1 + lengths() % config.max_segment;
+        starts.push_back(std::min(starts.back() + length, (int)keys.size()));
+    }
+    size_t num_segments = starts.size() - 1;
+    printf("Sorting %zu %s keys in %zu segments of up to %d keys...\n",
+           keys.size(), KeyTraits<T>::name, num_segments, config.max_segment);
+
+    std::vector<T> expected = keys;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < num_segments; i++) {
+        std::sort(expected.begin() + starts[i], expected.begin() + starts[i + 1]);
+    }
+    auto end = std::chrono::steady_clock::now();
+    double std_ms = std::chrono::duration<double, std::milli>(end - start).count();
 
-    size_t legion_serialize(void *buffer) const {
-        char *target = (char *)buffer;
-        *(size_t *)target = vec.size();
-        target += sizeof(size_t);
-        for (const auto &e : vec) {
-            *(T*)target = e;
-            target += sizeof(e);
+    start = std::chrono::steady_clock::now();
+    kernels::sort_tiny_segments(keys.data(), starts.data(), num_segments);
+    end = std::chrono::steady_clock::now();
+    double simd_ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+    printf("segments: std::sort %.3f ms, SIMD lanes %.3f ms (%.2fx), results %s\n",
+           std_ms, simd_ms, std_ms / simd_ms, keys == expected ? "match" : "DIFFER");
+}
+
+// True if the whole of `arg` is a decimal integer, such as a negative key
+static bool is_integer(const char *arg)
+{
+    char *end;
+    strtoll(arg, &end, 10);
+    return end != arg && *end == '\0';
+}
+
+// Bytes given as a number with an optional K, M or G suffix
+static long long parse_bytes(const char *arg)
+{
+    char *end;
+    long long bytes = strtoll(arg, &end, 10);
+    switch (*end) {
+    case 'G': case 'g':
+        bytes <<= 10;
+        // fall through
+    case 'M': case 'm':
+        bytes <<= 10;
+        // fall through
+    case 'K': case 'k':
+        bytes <<= 10;
+        end++;
+        break;
+    }
+    if (*end != '\0' || bytes <= 0) {
+        fprintf(stderr, "bad byte count: %s\n", arg);
+        exit(1);
+    }
+    return bytes;
+}
+
+// Reorder payload columns after the keys. Row i of column c holds
+// i * columns + c in its first bytes, so the moved rows show where they
+// came from. The two passes are compared with a scatter in input order.
+template<typename T>
+void run_payload(Context ctx, Runtime *runtime, IndexSpace is,
+                 const std::vector<T> &input, const T *sorted, const RunConfig &config)
+{
+    const int num_rows = input.size();
+    const int columns = config.payload_columns;
+    const size_t width = config.payload_bytes;
+    const size_t tag_bytes = std::min(width, sizeof(long long));
+    FieldSpace fs = runtime->create_field_space(ctx);
+    std::vector<FieldID> fields;
+    {
+        FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
+        allocator.allocate_field(sizeof(long long), FID_DEST);
+        for (int c = 0; c < columns; c++) {
+            fields.push_back(allocator.allocate_field(width, FID_PAYLOAD + c));
         }
-        debug("finish serializing");
-        return (size_t)target - (size_t)buffer;
-    }
-
-    size_t legion_deserialize(const void *buffer) {
-        const char *source = (const char *)buffer;
-        size_t length = *(const size_t *)source;
-        source += sizeof(size_t);
-        vec.resize(length);
-        for (auto &e : vec) {
-            e = *(const T*)source;
-            source += sizeof(e);
+    }
+    LogicalRegion src = runtime->create_logical_region(ctx, is, fs);
+    LogicalRegion dst = runtime->create_logical_region(ctx, is, fs);
+
+    RegionRequirement src_req(src, WRITE_DISCARD, EXCLUSIVE, src);
+    src_req.add_field(FID_DEST);
+    for (FieldID fid : fields) {
+        src_req.add_field(fid);
+    }
+    PhysicalRegion src_region = runtime->map_region(ctx, src_req);
+    src_region.wait_until_valid();
+    for (int c = 0; c < columns; c++) {
+        const FieldAccessor<WRITE_DISCARD, char, 1, coord_t,
+                            Realm::AffineAccessor<char, 1, coord_t>> column(src_region, fields[c], width);
+        char *rows = column.ptr(0);
+        memset(rows, 0, width * num_rows);
+        for (long long i = 0; i < num_rows; i++) {
+            long long tag = i * columns + c;
+            memcpy(rows + width * i, &tag, tag_bytes);
         }
-        debug("finish deserializing");
-        return (size_t)source - (size_t)buffer;
     }
-};
+    auto start = std::chrono::steady_clock::now();
+    {
+        const FieldAccessor<WRITE_DISCARD, long long, 1, coord_t,
+                            Realm::AffineAccessor<long long, 1, coord_t>> dest(src_region, FID_DEST);
+        sort_positions<T>(input.data(), sorted, num_rows, dest.ptr(0));
+    }
+    auto end = std::chrono::steady_clock::now();
+    double order_ms = std::chrono::duration<double, std::milli>(end - start).count();
+    runtime->unmap_region(ctx, src_region);
 
-void print_myvec(const MyVec<int> &sorted, int start, int end) {
-    for (int i = start; i < end; i++) {
-        if (sorted[i] == INT_MAX) {
-            printf("# ");
+    start = std::chrono::steady_clock::now();
+    apply_permutation(ctx, runtime, src, dst, fields, FID_DEST);
+    end = std::chrono::steady_clock::now();
+    double move_ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+    RegionRequirement req(dst, READ_ONLY, EXCLUSIVE, dst);
+    for (FieldID fid : fields) {
+        req.add_field(fid);
+    }
+    PhysicalRegion region = runtime->map_region(ctx, req);
+    region.wait_until_valid();
+    runtime->remap_region(ctx, src_region);
+    src_region.wait_until_valid();
+    const FieldAccessor<READ_ONLY, long long, 1, coord_t,
+                        Realm::AffineAccessor<long long, 1, coord_t>> dest(src_region, FID_DEST);
+    bool in_order = true;
+    for (int i = 0; i < num_rows; i++) {
+        in_order &= sorted[dest[i]] == input[i];
+    }
+    std::vector<char> flat(width * num_rows);
+    double flat_ms = 0;
+    for (int c = 0; c < columns; c++) {
+        const FieldAccessor<READ_ONLY, char, 1, coord_t,
+                            Realm::AffineAccessor<char, 1, coord_t>> column(region, fields[c], width);
+        const FieldAccessor<READ_ONLY, char, 1, coord_t,
+                            Realm::AffineAccessor<char, 1, coord_t>> input_column(src_region, fields[c], width);
+        const char *rows = column.ptr(0);
+        const char *input_rows = input_column.ptr(0);
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < num_rows; i++) {
+            memcpy(&flat[width * dest[i]], input_rows + width * i, width);
+        }
+        end = std::chrono::steady_clock::now();
+        flat_ms += std::chrono::duration<double, std::milli>(end - start).count();
+        in_order &= memcmp(flat.data(), rows, flat.size()) == 0;
+        for (int i = 0; i < num_rows && in_order; i++) {
+            long long tag = 0, expected = 0;
+            long long source = (long long)i * columns + c;
+            memcpy(&tag, rows + width * dest[i], tag_bytes);
+            memcpy(&expected, &source, tag_bytes);
+            in_order &= tag == expected;
+        }
+    }
+    runtime->unmap_region(ctx, src_region);
+    runtime->unmap_region(ctx, region);
+
+    double bytes = 2.0 * width * columns * num_rows;
+    printf("payload: %d columns of %zu bytes, positions in %.3f ms, moved in %.3f ms "
+           "(%.2f GB/s), %.3f ms in input order (%.2f GB/s), %s\n",
+           columns, width, order_ms, move_ms, bytes / move_ms * 1e-6,
+           flat_ms, bytes / flat_ms * 1e-6, in_order ? "rows follow their keys" : "ROWS MISPLACED");
+    runtime->destroy_logical_region(ctx, src);
+    runtime->destroy_logical_region(ctx, dst);
+    runtime->destroy_field_space(ctx, fs);
+}
+
+// Keys of the input, without reading them
+template<typename T>
+long long count_inputs(const RunConfig &config)
+{
+    if (config.input_file == NULL) {
+        return config.num_generated > 0 ? config.num_generated : config.inputs.size();
+    }
+    std::string file, name;
+    if (parse_arrow_path(config.input_file, file, name)) {
+        return ArrowColumnReader<T>(file, name).size();
+    }
+    if (parse_hdf5_path(config.input_file, file, name)) {
+        return hdf5_dataset_size<T>(file, name);
+    }
+    struct stat st;
+    if (stat(config.input_file, &st) != 0) {
+        perror(config.input_file);
+        exit(1);
+    }
+    return st.st_size / sizeof(T);
+}
+
+// Peak bytes of sorting n keys in memory: the region, the sort itself,
+// and the chunks of the reader or the writer
+template<typename T>
+long long in_memory_bytes(long long n, const SortOptions &options, const RunConfig &config)
+{
+    long long bytes = sizeof(T) * n + estimate_peak_bytes(n, options);
+    if (config.input_file != NULL || config.output_file != NULL) {
+        bytes += (long long)config.io.queue_depth * config.io.chunk_bytes;
+    }
+    return bytes;
+}
+
+// Peak bytes of an external sort in runs of run_keys keys. A run is sorted
+// while the reader fetches the next chunks and the run writer flushes its
+// own. The merge holds a share of the chunks for each run it reads and the
+// chunks of the output writer.
+template<typename T>
+long long external_bytes(long long run_keys, const SortOptions &options,
+                         const RunConfig &config)
+{
+    const IoOptions &io = config.io;
+    const long long io_bytes = (long long)io.queue_depth * io.chunk_bytes;
+    const int fan_in = config.external_options.merge_fan_in;
+    long long run_chunk = std::max<long long>(io.chunk_bytes / fan_in, 64 << 10);
+    long long run = sizeof(T) * run_keys + estimate_peak_bytes(run_keys, options)
+        + 2 * io_bytes;
+    long long merge = fan_in * io.queue_depth * run_chunk + io_bytes;
+    return std::max(run, merge);
+}
+
+// Sort the input externally when sorting it in memory would not fit in
+// -mem-budget, in the longest runs that do. Keys that are not in a file
+// are spilled to one first. False if the input is sorted in memory.
+template<typename T>
+bool run_within_budget(Context ctx, Runtime *runtime,
+                       const RunConfig &config, const SortOptions &options)
+{
+    long long num_keys = count_inputs<T>(config);
+    long long needed = in_memory_bytes<T>(num_keys, options, config);
+    printf("memory estimate: %.1f MiB for %lld keys, budget %.1f MiB\n",
+           needed / (double)(1 << 20), num_keys, config.mem_budget / (double)(1 << 20));
+    if (needed <= config.mem_budget) {
+        return false;
+    }
+
+    std::string file, name;
+    if ((config.input_file != NULL && (parse_hdf5_path(config.input_file, file, name)
+                                       || parse_arrow_path(config.input_file, file, name)))
+            || (config.output_file != NULL && (parse_hdf5_path(config.output_file, file, name)
+                                               || parse_arrow_path(config.output_file, file, name)))) {
+        fprintf(stderr, "over the memory budget, and only raw key files can be "
+                "sorted externally\n");
+        exit(1);
+    }
+    if (config.payload_columns > 0) {
+        fprintf(stderr, "over the memory budget, and payload columns are only "
+                "reordered in memory\n");
+        exit(1);
+    }
+    // the chunks in flight, and then the runs merged at once, are cut
+    // until the shortest runs fit
+    const long long min_run_keys = 1024;
+    RunConfig external = config;
+    while (external_bytes<T>(min_run_keys, options, external) > config.mem_budget) {
+        if (external.io.chunk_bytes > (64 << 10)) {
+            external.io.chunk_bytes /= 2;
+        } else if (external.external_options.merge_fan_in > 2) {
+            external.external_options.merge_fan_in /= 2;
         } else {
-            printf("%d ", sorted[i]);
+            fprintf(stderr, "a memory budget of %lld bytes is too small for the "
+                    "runs of an external sort\n", config.mem_budget);
+            exit(1);
+        }
+    }
+    // runs are powers of two, which the sort does not pad
+    long long run_keys = min_run_keys;
+    while (run_keys < num_keys
+            && external_bytes<T>(2 * run_keys, options, external) <= config.mem_budget) {
+        run_keys *= 2;
+    }
+    external.external = true;
+    external.external_options.run_keys = run_keys;
+    std::string spilled;
+    if (config.input_file == NULL) {
+        spilled = config.external_options.spill_dir + "/bitonic_input_"
+            + std::to_string(getpid()) + ".raw";
+        ChunkWriter writer(spilled.c_str(), external.io);
+        std::mt19937_64 rng(config.seed);
+        std::vector<T> block;
+        for (long long i = 0; i < num_keys; i++) {
+            if (config.num_generated > 0) {
+                block.push_back(generate_key<T>(config, i, rng));
+            } else {
+                assert(config.inputs[i] >= std::numeric_limits<T>::min());
+                assert(config.inputs[i] <= std::numeric_limits<T>::max());
+                block.push_back((T)config.inputs[i]);
+            }
+            if (block.size() == 4096 || i + 1 == num_keys) {
+                writer.write(block.data(), sizeof(T) * block.size());
+                block.clear();
+            }
+        }
+        writer.finish();
+        external.input_file = spilled.c_str();
+    }
+    printf("over the memory budget, sorting externally in runs of %lld keys, "
+           "%zu byte chunks, merging %d runs at once (%.1f MiB)\n",
+           run_keys, external.io.chunk_bytes, external.external_options.merge_fan_in,
+           external_bytes<T>(run_keys, options, external) / (double)(1 << 20));
+    run_external<T>(ctx, runtime, external, options);
+    if (!spilled.empty()) {
+        unlink(spilled.c_str());
+    }
+    return true;
+}
+
+template<typename T>
+void run_sorter(Context ctx, Runtime *runtime,
+                const RunConfig &config, const SortOptions &options)
+{
+    if (config.lookup_file != NULL) {
+        run_lookup<T>(config);
+        return;
+    }
+    if (config.max_segment > 0) {
+        run_segments<T>(config);
+        return;
+    }
+    if (config.external) {
+        run_external<T>(ctx, runtime, config, options);
+        return;
+    }
+    if (config.mem_budget > 0 && run_within_budget<T>(ctx, runtime, config, options)) {
+        return;
+    }
+    const std::vector<long long> &inputs = config.inputs;
+    int num_inputs = config.num_generated > 0 ? config.num_generated : inputs.size();
+    std::unique_ptr<ChunkReader> reader;
+    std::unique_ptr<ArrowColumnReader<T>> arrow;
+    std::string h5_file, h5_dataset, arrow_file, arrow_column;
+    bool sharded = config.input_file != NULL && is_sharded_input(config.input_file);
+    ShardSet shards;
+    bool h5_input = !sharded && config.input_file != NULL
+        && parse_hdf5_path(config.input_file, h5_file, h5_dataset);
+    if (sharded) {
+        shards = find_shards(config.input_file, sizeof(T));
+        num_inputs = shards.num_keys();
+        printf("Reading %zu shards of %s...\n", shards.size(), config.input_file);
+    } else if (config.input_file != NULL && parse_arrow_path(config.input_file, arrow_file, arrow_column)) {
+        arrow.reset(new ArrowColumnReader<T>(arrow_file, arrow_column));
+        num_inputs = arrow->size();
+        assert(num_inputs > 0);
+    } else if (h5_input) {
+        num_inputs = hdf5_dataset_size<T>(h5_file, h5_dataset);
+        assert(num_inputs > 0);
+    } else if (config.input_file != NULL) {
+        reader.reset(new ChunkReader(config.input_file, config.io));
+        assert(reader->size() % sizeof(T) == 0);
+        num_inputs = reader->size() / sizeof(T);
+        assert(num_inputs > 0);
+    }
+
+    printf("Running bitonic sorter for %d %s inputs...\n",
+           num_inputs, KeyTraits<T>::name);
+
+    // the keys live in a region that is sorted in place,
+    // and the result is read through an inline mapping
+    IndexSpace is = runtime->create_index_space(ctx, Rect<1>(0, num_inputs - 1));
+    FieldSpace fs = runtime->create_field_space(ctx);
+    {
+        FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
+        allocator.allocate_field(sizeof(T), FID_KEY);
+    }
+    LogicalRegion region = runtime->create_logical_region(ctx, is, fs);
+
+    PhysicalRegion attached;
+    // for sharded input the sort time includes the reads it overlaps with
+    auto start = std::chrono::steady_clock::now();
+    LogicalPartition pieces;
+    if (sharded) {
+        pieces = read_shards(ctx, runtime, shards, region, FID_KEY, config.io);
+    } else if (arrow && arrow->data() != NULL) {
+        // the column in the mapping is the instance sorted in place
+        Memory sysmem = Machine::MemoryQuery(Machine::get_machine())
+                .only_kind(Memory::SYSTEM_MEM).first();
+        assert(sysmem.exists());
+        AttachLauncher attacher(LEGION_EXTERNAL_INSTANCE, region, region);
+        std::vector<FieldID> fields {FID_KEY};
+        attacher.attach_array_soa(arrow->data(), false /*column major*/, fields, sysmem);
+        attached = runtime->attach_external_resource(ctx, attacher);
+    } else if (h5_input) {
+        read_hdf5<T>(ctx, runtime, h5_file, h5_dataset, region, FID_KEY);
+    } else {
+        RegionRequirement req(region, WRITE_DISCARD, EXCLUSIVE, region);
+        req.add_field(FID_KEY);
+        PhysicalRegion keys_region = runtime->map_region(ctx, req);
+        keys_region.wait_until_valid();
+        const FieldAccessor<WRITE_DISCARD, T, 1, coord_t, Realm::AffineAccessor<T, 1, coord_t>>
+            keys(keys_region, FID_KEY);
+        if (arrow) {
+            // the record batches of the column
+            arrow->read_all(keys.ptr(0));
+        } else if (reader) {
+            // later chunks are read while the earlier ones are copied
+            reader->read_all(keys.ptr(0));
+            reader.reset();
+        } else if (config.num_generated > 0) {
+            std::mt19937_64 rng(config.seed);
+            for (int i = 0; i < num_inputs; i++) {
+                keys[i] = generate_key<T>(config, i, rng);
+            }
+        } else {
+            for (int i = 0; i < num_inputs; i++) {
+                assert(inputs[i] >= std::numeric_limits<T>::min());
+                assert(inputs[i] <= std::numeric_limits<T>::max());
+                keys[i] = (T)inputs[i];
+            }
+        }
+        runtime->unmap_region(ctx, keys_region);
+    }
+
+    // the keys in input order, for the payload columns
+    std::vector<T> input_keys;
+    if (config.payload_columns > 0) {
+        RegionRequirement req(region, READ_ONLY, EXCLUSIVE, region);
+        req.add_field(FID_KEY);
+        PhysicalRegion keys_region = runtime->map_region(ctx, req);
+        keys_region.wait_until_valid();
+        const FieldAccessor<READ_ONLY, T, 1, coord_t, Realm::AffineAccessor<T, 1, coord_t>>
+            keys(keys_region, FID_KEY);
+        input_keys.assign(keys.ptr(0), keys.ptr(0) + num_inputs);
+        runtime->unmap_region(ctx, keys_region);
+    }
+
+    if (sharded) {
+        sort_shards(ctx, runtime, shards, region, pieces, FID_KEY, options);
+    } else {
+        start = std::chrono::steady_clock::now();
+        bitonic::sort(ctx, runtime, region, FID_KEY, options);
+    }
+
+    RegionRequirement req(region, READ_ONLY, EXCLUSIVE, region);
+    req.add_field(FID_KEY);
+    PhysicalRegion sorted_region = runtime->map_region(ctx, req);
+    sorted_region.wait_until_valid();
+    auto end = std::chrono::steady_clock::now();
+    const FieldAccessor<READ_ONLY, T, 1, coord_t, Realm::AffineAccessor<T, 1, coord_t>>
+        sorted(sorted_region, FID_KEY);
+
+    double ms = std::chrono::duration<double, std::milli>(end - start).count();
+    printf("sort time: %.3f ms, %.3f Mkeys/s\n", ms, num_inputs / ms * 1e-3);
+
+    if (config.search_queries > 0) {
+        run_search<T>(ctx, runtime, region, sorted.ptr(0), num_inputs, config);
+    }
+    if (config.payload_columns > 0) {
+        run_payload<T>(ctx, runtime, is, input_keys, sorted.ptr(0), config);
+    }
+    std::string h5_output_file, h5_output_dataset, arrow_output_file, arrow_output_column;
+    if (config.output_file != NULL
+            && parse_arrow_path(config.output_file, arrow_output_file, arrow_output_column)) {
+        if (arrow_output_column.empty()) {
+            arrow_output_column = arrow ? arrow->name() : "key";
         }
+        write_arrow_column<T>(arrow_output_file.c_str(), arrow_output_column,
+                              sorted.ptr(0), num_inputs, config.io);
+    } else if (config.output_file != NULL
+            && parse_hdf5_path(config.output_file, h5_output_file, h5_output_dataset)) {
+        write_hdf5<T>(ctx, runtime, region, FID_KEY, h5_output_file, h5_output_dataset);
+    } else if (config.output_file != NULL) {
+        SortedFileWriter<T> writer(config.output_file, config.output, config.io);
+        writer.append(sorted.ptr(0), num_inputs);
+        writer.finish();
+    }
+
+    // print result
+    if (config.quiet) {
+        bool in_order = std::is_sorted(sorted.ptr(0), sorted.ptr(0) + num_inputs);
+        printf("sorting results: %d keys %s\n", num_inputs,
+               in_order ? "in order" : "OUT OF ORDER");
+    } else {
+        printf("sorting results: ");
+        print_keys(sorted.ptr(0), 0, num_inputs, false);
+    }
+
+    runtime->unmap_region(ctx, sorted_region);
+    if (attached.exists()) {
+        runtime->detach_external_resource(ctx, attached).get_void_result();
     }
-    printf("\n");
+    runtime->destroy_logical_region(ctx, region);
+    runtime->destroy_field_space(ctx, fs);
+    runtime->destroy_index_space(ctx, is);
 }
 
 void top_level_task(const Task *task,
                     const std::vector<PhysicalRegion> &regions,
                     Context ctx, Runtime *runtime)
 {
-    int num_inputs = 0;
-    std::vector<int> nums;
+    RunConfig config;
+    SortOptions options;
+    long long num_simulated = 0;
+    CostModel cost_model;
+    bool report_utilization = false;
+    bool report_roofline = false;
+    // load the tuned options of this host, calibrating them when missing
+    bool tune = false;
+    bool retune = false;
+    std::string tune_profile = default_tune_profile();
+    long long tune_keys = DEFAULT_TUNE_KEYS;
+    // options given on the command line win over the tuned ones
+    bool leaf_given = false;
+    bool region_threshold_given = false;
+    bool stream_merge_given = false;
 
     // handle inputs
     const InputArgs &command_args = Runtime::get_input_args();
     for (int i = 1; i < command_args.argc; i++) {
-        if (command_args.argv[i][0] == '-') {
+        // keys may be negative, no flag is a number
+        if (command_args.argv[i][0] == '-' && !is_integer(command_args.argv[i])) {
+            if (!strcmp(command_args.argv[i], "-keytype") && i + 1 < command_args.argc) {
+                const char *name = command_args.argv[i+1];
+                if (!strcmp(name, KeyTraits<int16_t>::name)) {
+                    options.key_type = KEY_INT16;
+                } else if (!strcmp(name, KeyTraits<uint16_t>::name)) {
+                    options.key_type = KEY_UINT16;
+                } else if (!strcmp(name, KeyTraits<uint8_t>::name)) {
+                    options.key_type = KEY_UINT8;
+                } else {
+                    assert(!strcmp(name, KeyTraits<int>::name));
+                }
+            } else if (!strcmp(command_args.argv[i], "-leaf") && i + 1 < command_args.argc) {
+                options.leaf_size = atoi(command_args.argv[i+1]);
+                leaf_given = true;
+                // leaf blocks must evenly divide the padded input
+                assert(options.leaf_size >= 2);
+                assert((options.leaf_size & (options.leaf_size - 1)) == 0);
+            } else if (!strcmp(command_args.argv[i], "-region-threshold") && i + 1 < command_args.argc) {
+                // in bytes, blocks this large are passed through regions
+                options.region_threshold = atoll(command_args.argv[i+1]);
+                region_threshold_given = true;
+            } else if (!strcmp(command_args.argv[i], "-simulate") && i + 1 < command_args.argc) {
+                // number of keys to simulate the sort for
+                num_simulated = atoll(command_args.argv[i+1]);
+            } else if (!strcmp(command_args.argv[i], "-sim-task-us") && i + 1 < command_args.argc) {
+                cost_model.task_us = atof(command_args.argv[i+1]);
+            } else if (!strcmp(command_args.argv[i], "-sim-procs") && i + 1 < command_args.argc) {
+                cost_model.num_procs = atoi(command_args.argv[i+1]);
+            } else if (!strcmp(command_args.argv[i], "-ll:cpu") && i + 1 < command_args.argc) {
+                // simulate with the processors given to Legion by default
+                cost_model.num_procs = atoi(command_args.argv[i+1]);
+            } else if (!strcmp(command_args.argv[i], "-n") && i + 1 < command_args.argc) {
+                config.num_generated = atoll(command_args.argv[i+1]);
+            } else if (!strcmp(command_args.argv[i], "-dist") && i + 1 < command_args.argc) {
+                const char *name = command_args.argv[i+1];
+                if (!strcmp(name, "sorted")) {
+                    config.dist = DIST_SORTED;
+                } else if (!strcmp(name, "reverse")) {
+                    config.dist = DIST_REVERSE;
+                } else if (!strcmp(name, "few")) {
+                    config.dist = DIST_FEW;
+                } else {
+                    assert(!strcmp(name, "uniform"));
+                }
+            } else if (!strcmp(command_args.argv[i], "-seed") && i + 1 < command_args.argc) {
+                config.seed = strtoull(command_args.argv[i+1], NULL, 10);
+            } else if (!strcmp(command_args.argv[i], "-input") && i + 1 < command_args.argc) {
+                config.input_file = command_args.argv[i+1];
+            } else if (!strcmp(command_args.argv[i], "-output") && i + 1 < command_args.argc) {
+                config.output_file = command_args.argv[i+1];
+            } else if (!strcmp(command_args.argv[i], "-io-depth") && i + 1 < command_args.argc) {
+                config.io.queue_depth = atoi(command_args.argv[i+1]);
+                assert(config.io.queue_depth > 0);
+            } else if (!strcmp(command_args.argv[i], "-io-chunk") && i + 1 < command_args.argc) {
+                config.io.chunk_bytes = atoll(command_args.argv[i+1]);
+                assert(config.io.chunk_bytes > 0);
+            } else if (!strcmp(command_args.argv[i], "-run-keys") && i + 1 < command_args.argc) {
+                config.external = true;
+                config.external_options.run_keys = atoll(command_args.argv[i+1]);
+                assert(config.external_options.run_keys > 0);
+            } else if (!strcmp(command_args.argv[i], "-merge-fan-in") && i + 1 < command_args.argc) {
+                config.external_options.merge_fan_in = atoi(command_args.argv[i+1]);
+                assert(config.external_options.merge_fan_in >= 2);
+            } else if (!strcmp(command_args.argv[i], "-mem-budget") && i + 1 < command_args.argc) {
+                config.mem_budget = parse_bytes(command_args.argv[i+1]);
+            } else if (!strcmp(command_args.argv[i], "-spill-dir") && i + 1 < command_args.argc) {
+                config.external_options.spill_dir = command_args.argv[i+1];
+            } else if (!strcmp(command_args.argv[i], "-no-spill-compress")) {
+                config.external_options.compress_runs = false;
+                continue;
+            } else if (!strcmp(command_args.argv[i], "-indexed-output")) {
+                config.output.indexed = true;
+                continue;
+            } else if (!strcmp(command_args.argv[i], "-output-compress")) {
+                config.output.indexed = true;
+                config.output.compress = true;
+                continue;
+            } else if (!strcmp(command_args.argv[i], "-search") && i + 1 < command_args.argc) {
+                config.search_queries = atoi(command_args.argv[i+1]);
+            } else if (!strcmp(command_args.argv[i], "-payload") && i + 1 < command_args.argc) {
+                config.payload_columns = atoi(command_args.argv[i+1]);
+                assert(config.payload_columns > 0);
+            } else if (!strcmp(command_args.argv[i], "-payload-bytes") && i + 1 < command_args.argc) {
+                config.payload_bytes = atoll(command_args.argv[i+1]);
+                assert(config.payload_bytes > 0);
+            } else if (!strcmp(command_args.argv[i], "-lookup") && i + 1 < command_args.argc) {
+                config.lookup_file = command_args.argv[i+1];
+            } else if (!strcmp(command_args.argv[i], "-segments") && i + 1 < command_args.argc) {
+                config.max_segment = atoi(command_args.argv[i+1]);
+                assert(config.max_segment > 0 && config.max_segment <= (int)kernels::MAX_TINY_SEGMENT);
+            } else if (!strcmp(command_args.argv[i], "-no-uring")) {
+                config.io.use_uring = false;
+                continue;
+            } else if (!strcmp(command_args.argv[i], "-quiet")) {
+                config.quiet = true;
+                continue;
+            } else if (!strcmp(command_args.argv[i], "-trace") && i + 1 < command_args.argc) {
+                enable_trace(command_args.argv[i+1]);
+            } else if (!strcmp(command_args.argv[i], "-util")) {
+                report_utilization = true;
+                continue;
+            } else if (!strcmp(command_args.argv[i], "-roofline")) {
+                report_roofline = true;
+                continue;
+            } else if (!strcmp(command_args.argv[i], "-compress")) {
+                // a flag without value
+                options.compress = true;
+                continue;
+            } else if (!strcmp(command_args.argv[i], "-stream-merge")) {
+                options.stream_merge = true;
+                stream_merge_given = true;
+                continue;
+            } else if (!strcmp(command_args.argv[i], "-recursive")) {
+                options.recursive = true;
+                continue;
+            } else if (!strcmp(command_args.argv[i], "-tune")) {
+                tune = true;
+                continue;
+            } else if (!strcmp(command_args.argv[i], "-retune")) {
+                tune = true;
+                retune = true;
+                continue;
+            } else if (!strcmp(command_args.argv[i], "-tune-profile") && i + 1 < command_args.argc) {
+                tune_profile = command_args.argv[i+1];
+            } else if (!strcmp(command_args.argv[i], "-tune-keys") && i + 1 < command_args.argc) {
+                tune_keys = atoll(command_args.argv[i+1]);
+                assert(tune_keys > 0);
+            }
             i++;
             continue;
         }
-        int input = atoi(command_args.argv[i]);
-        nums.push_back(input);
-        num_inputs++;
-    }
-    assert(num_inputs > 0);
-
-    // find the next-least power of 2,
-    // and to fill up with max values
-    int num_total = num_inputs;
-    while (num_total != (num_total & (-num_total))) {
-        num_total += (num_total & (-num_total));
-    }
-    for (int i = num_inputs; i < num_total; i++) {
-        nums.push_back(INT_MAX);
-    }
-
-    printf("Running bitonic sorter for %d inputs...\n", num_inputs);
-
-    // First, do single swaps to acquire initial future results
-    std::vector<std::vector<Future>> iterResults;
-    std::vector<Future> results;
-    for (int lo = 0; lo < num_total; lo += 2) {
-        debug("input: %d %d\n", nums[lo], nums[lo+1]);
-        int args[] = {nums[lo], nums[lo+1]};
-        TaskLauncher single_swaper(SINGLE_SWAP_TASK_ID, TaskArgument(&args[0], sizeof(int) * 2));
-        Future res = runtime->execute_task(ctx, single_swaper);
-        results.push_back(res);
-    }
-    iterResults.push_back(results);
-
-    // Then iteratively merge sorting results from previous operations,
-    for (int gap = 4; gap <= num_total; gap <<= 1) {
-        int j = 0;
-        std::vector<Future> results;
-        for (int lo = 0; lo < num_total; lo += gap) {
-            // spawn a sub-task for each subsorter block
-            // a subsorter requires the sorting results of two previous subsorters
-            TaskLauncher subsorter(SUBSORTER_TASK_ID, TaskArgument(NULL, 0));
-            subsorter.add_future(iterResults.back()[j * 2]);
-            subsorter.add_future(iterResults.back()[j * 2 + 1]);
-            Future res = runtime->execute_task(ctx, subsorter);
-            results.push_back(res);
-            j++;
-        }
-        iterResults.push_back(results);
+        config.inputs.push_back(atoll(command_args.argv[i]));
     }
-    assert(iterResults.back().size() == 1);
 
-    auto final_result = iterResults.back()[0];
-    const auto &sorted = final_result.get_result<MyVec<int>>();
-    assert(sorted.size() == num_total);
-
-    // print result
-    printf("sorting results: ");
-    print_myvec(sorted, 0, num_inputs);
-}
-
-MyVec<int> subsorter_task(const Task *task,
-                          const std::vector<PhysicalRegion> &regions,
-                          Context ctx, Runtime *runtime)
-{
-    assert(task->futures.size() == 2);
-
-    Future f1 = task->futures[0];
-    auto vec1 = f1.get_result<MyVec<int>>();
-    Future f2 = task->futures[1];
-    auto vec2 = f2.get_result<MyVec<int>>();
-
-    assert(vec1.size() == vec2.size());
-    int num_vec = vec1.size();
-    int num_total = num_vec * 2;
-
-    MyVec<int> sorted(num_total);
-    std::vector<Future> results;
-
-    // First do crosswork,
-    // split the sorted subsequences into bitonic subsequences
-    //
-    // launch tasks
-    for (int i = 0; i < num_vec; i++) {
-        int args[] = {vec1[i], vec2[num_vec-i-1]};
-        TaskLauncher launcher(SINGLE_SWAP_TASK_ID, TaskArgument(&args[0], sizeof(int) * 2));
-        Future res = runtime->execute_task(ctx, launcher);
-        results.push_back(res);
-    }
-    // get results
-    for (int i = 0; i < num_vec; i++) {
-        auto values = results[i].get_result<MyVec<int>>();
-        sorted[i] = values[0];
-        sorted[num_total-i-1] = values[1];
-    }
-    results.clear();
-
-    // Then sort each bitonic subsequence
-    for (int gap = num_vec; gap > 1; gap /= 2) {
-        // launch tasks
-        for (int lo = 0; lo < num_total; lo += gap) {
-            int half_sz = gap / 2;
-            for (int i = 0; i < half_sz; i++) {
-                int args[] = {sorted[lo+i], sorted[lo+i+half_sz]};
-                TaskLauncher launcher(SINGLE_SWAP_TASK_ID, TaskArgument(&args[0], sizeof(int) * 2));
-                Future res = runtime->execute_task(ctx, launcher);
-                results.push_back(res);
-            }
+    if (tune) {
+        SortOptions tuned = options;
+        if (retune || !load_tuning(tune_profile.c_str(), tuned)) {
+            auto start = std::chrono::steady_clock::now();
+            tuned = tune_sort_options(ctx, runtime, options, tune_keys);
+            auto end = std::chrono::steady_clock::now();
+            printf("calibrated in %.3f ms, saved to %s\n",
+                   std::chrono::duration<double, std::milli>(end - start).count(),
+                   tune_profile.c_str());
+            save_tuning(tune_profile.c_str(), tuned);
         }
-        // get results
-        int j = 0;
-        for (int lo = 0; lo < num_total; lo += gap) {
-            int half_sz = gap / 2;
-            for (int i = 0; i < half_sz; i++) {
-                auto values = results[j].get_result<MyVec<int>>();
-                sorted[lo+i] = values[0];
-                sorted[lo+i+half_sz] = values[1];
-                j++;
-            }
+        if (!leaf_given) {
+            options.leaf_size = tuned.leaf_size;
+        }
+        if (!region_threshold_given) {
+            options.region_threshold = tuned.region_threshold;
         }
-        results.clear();
+        if (!stream_merge_given) {
+            options.stream_merge = tuned.stream_merge;
+        }
+        print_tuning(options);
     }
 
-    // may get disordered output ?
-    printf("subsorter results: ");
-    print_myvec(sorted, 0, num_total);
-    return sorted;
-}
+    if (num_simulated > 0) {
+        assert(cost_model.num_procs > 0);
+        calibrate_cost_model(cost_model, options.key_type);
+        auto result = simulate(num_simulated, options, cost_model);
+        print_simulation(result, options, cost_model);
+        return;
+    }
+    assert(config.inputs.size() > 0 || config.num_generated > 0 || config.input_file != NULL
+           || config.lookup_file != NULL);
+    assert(!config.external || config.input_file != NULL);
+    // payload columns are reordered in memory only
+    assert(!config.external || config.payload_columns == 0);
+    // segments are sorted from generated or given keys
+    assert(config.max_segment == 0 || config.input_file == NULL);
+    // sharded input is sorted in memory
+    assert(config.input_file == NULL || !is_sharded_input(config.input_file)
+           || (!config.external && config.mem_budget == 0));
 
-MyVec<int> single_swap_task(const Task *task,
-                            const std::vector<PhysicalRegion> &regions,
-                            Context ctx, Runtime *runtime)
-{
-    assert(task->arglen == sizeof(int) * 2);
-    auto values = (const int *)(task->args);
-    debug("swap: %d %d\n", values[0], values[1]);
-    MyVec<int> result {std::min(values[0], values[1]), std::max(values[0], values[1])};
-    return result;
+    enable_roofline(report_roofline);
+    enable_utilization(report_utilization);
+    switch (options.key_type) {
+    case KEY_INT16:
+        run_sorter<int16_t>(ctx, runtime, config, options);
+        break;
+    case KEY_UINT16:
+        run_sorter<uint16_t>(ctx, runtime, config, options);
+        break;
+    case KEY_UINT8:
+        run_sorter<uint8_t>(ctx, runtime, config, options);
+        break;
+    default:
+        run_sorter<int>(ctx, runtime, config, options);
+        break;
+    }
+
+    if (report_utilization) {
+        print_utilization();
+    }
+    if (report_roofline) {
+        print_roofline();
+    }
+    if (trace_enabled()) {
+        write_trace();
+    }
 }
 
 int main(int argc, char **argv)
@@ -239,18 +918,7 @@ int main(int argc, char **argv)
         Runtime::preregister_task_variant<top_level_task>(registrar, "top_level");
     }
 
-    {
-        TaskVariantRegistrar registrar(SUBSORTER_TASK_ID, "subsorter");
-        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
-        Runtime::preregister_task_variant<MyVec<int>, subsorter_task>(registrar, "subsorter");
-    }
-
-    {
-        TaskVariantRegistrar registrar(SINGLE_SWAP_TASK_ID, "single_swap");
-        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
-        registrar.set_leaf(true);
-        Runtime::preregister_task_variant<MyVec<int>, single_swap_task>(registrar, "single_swap");
-    }
+    bitonic::register_tasks();
 
     return Runtime::start(argc, argv);
 }
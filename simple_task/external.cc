@@ -0,0 +1,252 @@
+// External sort of key files larger than memory
+
+#include <algorithm>
+#include <cassert>
+#include <queue>
+#include <unistd.h>
+#include "external.h"
+
+using namespace Legion;
+
+namespace bitonic {
+
+template<typename T>
+RunWriter<T>::RunWriter(const char *path, bool compress, const IoOptions &io)
+    : compress(compress), writer(path, io)
+{
+    block.reserve(RUN_BLOCK_KEYS);
+}
+
+template<typename T>
+void RunWriter<T>::append(const T *keys, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        block.push_back(keys[i]);
+        if (block.size() == RUN_BLOCK_KEYS) {
+            flush_block();
+        }
+    }
+}
+
+template<typename T>
+void RunWriter<T>::finish()
+{
+    if (!block.empty()) {
+        flush_block();
+    }
+    writer.finish();
+}
+
+template<typename T>
+void RunWriter<T>::flush_block()
+{
+    write_block(writer, block.data(), block.size(), compress, packed);
+    block.clear();
+}
+
+template<typename T>
+RunReader<T>::RunReader(const char *path, const IoOptions &io)
+    : reader(path, io), chunk(NULL), chunk_left(0), pos(0)
+{
+    file_left = reader.size();
+}
+
+template<typename T>
+void RunReader<T>::read_bytes(void *dst, size_t bytes)
+{
+    char *out = (char *)dst;
+    assert(bytes <= file_left);
+    file_left -= bytes;
+    while (bytes > 0) {
+        if (chunk_left == 0) {
+            chunk = reader.next(chunk_left);
+            assert(chunk != NULL);
+        }
+        size_t n = std::min(bytes, chunk_left);
+        memcpy(out, chunk, n);
+        chunk += n;
+        chunk_left -= n;
+        out += n;
+        bytes -= n;
+    }
+}
+
+template<typename T>
+bool RunReader<T>::read_block()
+{
+    if (file_left == 0) {
+        return false;
+    }
+    KeyBlockHeader header;
+    read_bytes(&header, sizeof(header));
+    assert(header.count > 0 && header.count <= RUN_BLOCK_KEYS);
+    size_t bytes = block_payload_bytes<T>(header);
+    packed.resize((bytes + BLOCK_DECODE_PADDING + 7) / 8);
+    read_bytes(packed.data(), bytes);
+    block.resize(header.count);
+    decode_block(header, (const char *)packed.data(), block.data());
+    pos = 0;
+    return true;
+}
+
+static std::string run_path(const ExternalOptions &external, int pass, size_t run)
+{
+    return external.spill_dir + "/bitonic_run_" + std::to_string(getpid()) + "_"
+        + std::to_string(pass) + "_" + std::to_string(run) + ".run";
+}
+
+// Merge the runs with a heap of their next keys, passing the merged keys
+// to `sink` in batches of up to a block. The run files are removed.
+template<typename T, typename Sink>
+static void merge_runs(const std::vector<std::string> &paths, const IoOptions &io, Sink sink)
+{
+    std::vector<std::unique_ptr<RunReader<T>>> runs;
+    typedef std::pair<T, int> Head;
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+    for (size_t i = 0; i < paths.size(); i++) {
+        runs.emplace_back(new RunReader<T>(paths[i].c_str(), io));
+        T key;
+        if (runs[i]->next(key)) {
+            heads.push(Head(key, i));
+        }
+    }
+    std::vector<T> merged;
+    merged.reserve(RUN_BLOCK_KEYS);
+    while (!heads.empty()) {
+        Head head = heads.top();
+        heads.pop();
+        merged.push_back(head.first);
+        if (merged.size() == RUN_BLOCK_KEYS) {
+            sink(merged.data(), merged.size());
+            merged.clear();
+        }
+        T key;
+        if (runs[head.second]->next(key)) {
+            heads.push(Head(key, head.second));
+        }
+    }
+    if (!merged.empty()) {
+        sink(merged.data(), merged.size());
+    }
+    runs.clear();
+    for (auto &path : paths) {
+        unlink(path.c_str());
+    }
+}
+
+template<typename T>
+ExternalStats sort_file(Context ctx, Runtime *runtime,
+                        const char *input, const char *output,
+                        const SortOptions &options, const ExternalOptions &external)
+{
+    assert(external.run_keys > 0);
+    ExternalStats stats;
+    ChunkReader reader(input, external.io);
+    assert(reader.size() % sizeof(T) == 0);
+    stats.num_keys = reader.size() / sizeof(T);
+
+    // sort and spill the runs,
+    // the reader keeps fetching the next chunks while a run is sorted
+    std::vector<std::string> paths;
+    const char *chunk = NULL;
+    size_t chunk_left = 0;
+    for (long long lo = 0; lo < stats.num_keys; lo += external.run_keys) {
+        long long n = std::min(external.run_keys, stats.num_keys - lo);
+        std::vector<T> nums(n);
+        char *dst = (char *)nums.data();
+        for (size_t bytes = sizeof(T) * n; bytes > 0;) {
+            if (chunk_left == 0) {
+                chunk = reader.next(chunk_left);
+                assert(chunk != NULL);
+            }
+            size_t len = std::min(bytes, chunk_left);
+            memcpy(dst, chunk, len);
+            dst += len;
+            chunk += len;
+            chunk_left -= len;
+            bytes -= len;
+        }
+        auto sorted = sort_values<T>(ctx, runtime, std::move(nums), options);
+
+        paths.push_back(run_path(external, 0, stats.runs));
+        RunWriter<T> run(paths.back().c_str(), external.compress_runs, external.io);
+        run.append(sorted.data(), n);
+        run.finish();
+        debug("spilled run %lld: %lld keys in %zu bytes\n", stats.runs, n, run.file_bytes());
+        stats.runs++;
+        stats.raw_bytes += sizeof(T) * n;
+        stats.spill_bytes += run.file_bytes();
+    }
+
+    // the readers of a merge share about one chunk per queue slot
+    IoOptions run_io = external.io;
+    run_io.chunk_bytes = std::max<size_t>(run_io.chunk_bytes / external.merge_fan_in, 64 << 10);
+
+    // merge groups of runs into longer runs until one pass is left
+    int pass = 0;
+    while ((int)paths.size() > external.merge_fan_in) {
+        std::vector<std::string> merged_paths;
+        for (size_t lo = 0; lo < paths.size(); lo += external.merge_fan_in) {
+            std::vector<std::string> group(paths.begin() + lo, paths.begin()
+                    + std::min(paths.size(), lo + external.merge_fan_in));
+            merged_paths.push_back(run_path(external, pass + 1, merged_paths.size()));
+            RunWriter<T> run(merged_paths.back().c_str(), external.compress_runs, external.io);
+            merge_runs<T>(group, run_io, [&](const T *keys, size_t n) {
+                run.append(keys, n);
+                stats.raw_bytes += sizeof(T) * n;
+            });
+            run.finish();
+            stats.spill_bytes += run.file_bytes();
+        }
+        paths.swap(merged_paths);
+        pass++;
+    }
+
+    std::unique_ptr<SortedFileWriter<T>> writer;
+    if (output != NULL) {
+        writer.reset(new SortedFileWriter<T>(output, external.output, external.io));
+    }
+    long long num_merged = 0;
+    T last = std::numeric_limits<T>::min();
+    merge_runs<T>(paths, run_io, [&](const T *keys, size_t n) {
+        stats.in_order &= last <= keys[0] && std::is_sorted(keys, keys + n);
+        last = keys[n - 1];
+        num_merged += n;
+        if (writer) {
+            writer->append(keys, n);
+        }
+    });
+    stats.in_order &= num_merged == stats.num_keys;
+    if (writer) {
+        writer->finish();
+    }
+    return stats;
+}
+
+void print_external_stats(const ExternalStats &stats)
+{
+    printf("external sort: %lld keys in %lld runs, spilled %lld bytes for %lld "
+           "bytes of keys (%.2fx)\n",
+           stats.num_keys, stats.runs, stats.spill_bytes, stats.raw_bytes,
+           stats.spill_bytes > 0 ? (double)stats.raw_bytes / stats.spill_bytes : 0.0);
+}
+
+template class RunWriter<int>;
+template class RunWriter<int16_t>;
+template class RunWriter<uint16_t>;
+template class RunWriter<uint8_t>;
+template class RunReader<int>;
+template class RunReader<int16_t>;
+template class RunReader<uint16_t>;
+template class RunReader<uint8_t>;
+
+template ExternalStats sort_file<int>(Context, Runtime *, const char *, const char *,
+        const SortOptions &, const ExternalOptions &);
+template ExternalStats sort_file<int16_t>(Context, Runtime *, const char *, const char *,
+        const SortOptions &, const ExternalOptions &);
+template ExternalStats sort_file<uint16_t>(Context, Runtime *, const char *, const char *,
+        const SortOptions &, const ExternalOptions &);
+template ExternalStats sort_file<uint8_t>(Context, Runtime *, const char *, const char *,
+        const SortOptions &, const ExternalOptions &);
+
+} // namespace bitonic
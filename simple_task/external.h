@@ -0,0 +1,106 @@
+// External sort of key files larger than memory
+// The input is sorted in runs of a fixed number of keys, each run is
+// spilled to disk, and the runs are merged into the output. Runs are
+// stored as sorted file blocks of delta-encoded, bit-packed keys by
+// default, since sorted keys have small deltas.
+
+#ifndef BITONIC_EXTERNAL_H
+#define BITONIC_EXTERNAL_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "bitonic.h"
+#include "io.h"
+#include "sorted_file.h"
+
+namespace bitonic {
+
+const long long DEFAULT_RUN_KEYS = 1 << 24;
+const int DEFAULT_MERGE_FAN_IN = 64;
+
+struct ExternalOptions {
+    // keys sorted in memory at a time
+    long long run_keys = DEFAULT_RUN_KEYS;
+    // directory of the run files, removed after the merge
+    std::string spill_dir = "/tmp";
+    // delta-encode and bit-pack the runs
+    bool compress_runs = true;
+    // runs merged at once, more runs are merged in several passes
+    int merge_fan_in = DEFAULT_MERGE_FAN_IN;
+    IoOptions io;
+    OutputOptions output;
+};
+
+struct ExternalStats {
+    long long num_keys = 0;
+    long long runs = 0;
+    // bytes of the runs of all merge passes, and of their files
+    long long raw_bytes = 0;
+    long long spill_bytes = 0;
+    bool in_order = true;
+};
+
+// Writes sorted keys to a run file block by block
+template<typename T>
+class RunWriter {
+public:
+    RunWriter(const char *path, bool compress, const IoOptions &io = IoOptions());
+
+    void append(const T *keys, size_t n);
+    void finish();
+
+    size_t file_bytes() const { return writer.size(); }
+
+private:
+    void flush_block();
+
+    bool compress;
+    ChunkWriter writer;
+    std::vector<T> block;
+    std::vector<uint64_t> packed;
+};
+
+// Reads the keys of a run file back in order
+template<typename T>
+class RunReader {
+public:
+    RunReader(const char *path, const IoOptions &io = IoOptions());
+
+    // the next key, false after the last one
+    bool next(T &key) {
+        if (pos == block.size() && !read_block()) {
+            return false;
+        }
+        key = block[pos++];
+        return true;
+    }
+
+private:
+    bool read_block();
+    void read_bytes(void *dst, size_t bytes);
+
+    ChunkReader reader;
+    // bytes of the file not read yet, and of the current chunk
+    size_t file_left;
+    const char *chunk;
+    size_t chunk_left;
+    std::vector<T> block;
+    size_t pos;
+    std::vector<uint64_t> packed;
+};
+
+// Sort the raw keys of `input` in runs of external.run_keys keys and merge
+// the runs into `output`. Without an output file the merged keys are only
+// counted and checked.
+template<typename T>
+ExternalStats sort_file(Legion::Context ctx, Legion::Runtime *runtime,
+                        const char *input, const char *output,
+                        const SortOptions &options,
+                        const ExternalOptions &external = ExternalOptions());
+
+void print_external_stats(const ExternalStats &stats);
+
+} // namespace bitonic
+
+#endif // BITONIC_EXTERNAL_H
@@ -0,0 +1,239 @@
+// HDF5 datasets of keys
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <unistd.h>
+#include "hdf5_file.h"
+#if defined(LEGION_USE_HDF5) || defined(USE_HDF)
+#include <hdf5.h>
+#endif
+
+using namespace Legion;
+
+namespace bitonic {
+
+bool parse_hdf5_path(const char *path, std::string &file, std::string &dataset)
+{
+    const char *sep = strstr(path, ":/");
+    if (sep == NULL) {
+        return false;
+    }
+    file.assign(path, sep - path);
+    dataset = sep + 1;
+    return true;
+}
+
+#if defined(LEGION_USE_HDF5) || defined(USE_HDF)
+
+enum {
+    FID_HDF5_KEY,
+};
+
+static void hdf5_error(const std::string &file, const std::string &dataset, const char *what)
+{
+    fprintf(stderr, "%s:%s: %s\n", file.c_str(), dataset.c_str(), what);
+    exit(1);
+}
+
+template<typename T> static hid_t native_type();
+template<> hid_t native_type<int>() { return H5T_NATIVE_INT; }
+template<> hid_t native_type<int16_t>() { return H5T_NATIVE_INT16; }
+template<> hid_t native_type<uint16_t>() { return H5T_NATIVE_UINT16; }
+template<> hid_t native_type<uint8_t>() { return H5T_NATIVE_UINT8; }
+
+template<typename T>
+long long hdf5_dataset_size(const std::string &file, const std::string &dataset)
+{
+    hid_t file_id = H5Fopen(file.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (file_id < 0) {
+        hdf5_error(file, dataset, "cannot open the file");
+    }
+    hid_t dataset_id = H5Dopen2(file_id, dataset.c_str(), H5P_DEFAULT);
+    if (dataset_id < 0) {
+        hdf5_error(file, dataset, "no such dataset");
+    }
+    // the attached instance holds the keys as they are in the file
+    hid_t type_id = H5Dget_type(dataset_id);
+    if (H5Tequal(type_id, native_type<T>()) <= 0) {
+        hdf5_error(file, dataset, "keys are not of the native key type");
+    }
+    hid_t space_id = H5Dget_space(dataset_id);
+    hsize_t dims[1];
+    if (H5Sget_simple_extent_ndims(space_id) != 1) {
+        hdf5_error(file, dataset, "not a 1-D dataset");
+    }
+    H5Sget_simple_extent_dims(space_id, dims, NULL);
+    H5Sclose(space_id);
+    H5Tclose(type_id);
+    H5Dclose(dataset_id);
+    H5Fclose(file_id);
+    return dims[0];
+}
+
+template<typename T>
+static void create_dataset(const std::string &file, const std::string &dataset, hsize_t size)
+{
+    hid_t file_id = access(file.c_str(), F_OK) == 0
+        ? H5Fopen(file.c_str(), H5F_ACC_RDWR, H5P_DEFAULT)
+        : H5Fcreate(file.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    if (file_id < 0) {
+        hdf5_error(file, dataset, "cannot open the file for writing");
+    }
+    // fails quietly when a group on the path is missing too
+    htri_t exists = 0;
+    H5E_BEGIN_TRY {
+        exists = H5Lexists(file_id, dataset.c_str(), H5P_DEFAULT);
+    } H5E_END_TRY;
+    if (exists > 0) {
+        H5Ldelete(file_id, dataset.c_str(), H5P_DEFAULT);
+    }
+    hid_t link_props = H5Pcreate(H5P_LINK_CREATE);
+    H5Pset_create_intermediate_group(link_props, 1);
+    hid_t space_id = H5Screate_simple(1, &size, NULL);
+    hid_t dataset_id = H5Dcreate2(file_id, dataset.c_str(), native_type<T>(), space_id,
+                                  link_props, H5P_DEFAULT, H5P_DEFAULT);
+    if (dataset_id < 0) {
+        hdf5_error(file, dataset, "cannot create the dataset");
+    }
+    H5Dclose(dataset_id);
+    H5Sclose(space_id);
+    H5Pclose(link_props);
+    H5Fclose(file_id);
+}
+
+// Copy between two regions of the same index space, one piece per processor
+static void copy_pieces(Context ctx, Runtime *runtime,
+                        LogicalRegion src, FieldID src_fid,
+                        LogicalRegion dst, FieldID dst_fid)
+{
+    Machine::ProcessorQuery procs(Machine::get_machine());
+    procs.only_kind(Processor::LOC_PROC).local_address_space();
+    coord_t pieces = std::max<coord_t>(procs.count(), 1);
+    IndexSpace is = src.get_index_space();
+    IndexSpace colors = runtime->create_index_space(ctx, Rect<1>(0, pieces - 1));
+    IndexPartition ip = runtime->create_equal_partition(ctx, is, colors);
+    IndexCopyLauncher copy(colors);
+    copy.add_copy_requirements(
+            RegionRequirement(runtime->get_logical_partition(ctx, src, ip), 0,
+                              READ_ONLY, EXCLUSIVE, src),
+            RegionRequirement(runtime->get_logical_partition(ctx, dst, ip), 0,
+                              WRITE_DISCARD, EXCLUSIVE, dst));
+    copy.src_requirements.back().add_field(src_fid);
+    copy.dst_requirements.back().add_field(dst_fid);
+    runtime->issue_copy_operation(ctx, copy);
+    runtime->destroy_index_space(ctx, colors);
+}
+
+// Attach the dataset to a new region over the index space of `region`
+template<typename T>
+static PhysicalRegion attach_dataset(Context ctx, Runtime *runtime,
+                                     const std::string &file, const std::string &dataset,
+                                     LogicalRegion region, LegionFileMode mode,
+                                     LogicalRegion &file_region)
+{
+    FieldSpace fs = runtime->create_field_space(ctx);
+    {
+        FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
+        allocator.allocate_field(sizeof(T), FID_HDF5_KEY);
+    }
+    file_region = runtime->create_logical_region(ctx, region.get_index_space(), fs);
+    AttachLauncher attacher(LEGION_EXTERNAL_HDF5_FILE, file_region, file_region);
+    std::map<FieldID, const char *> fields;
+    fields[FID_HDF5_KEY] = dataset.c_str();
+    attacher.attach_hdf5(file.c_str(), fields, mode);
+    return runtime->attach_external_resource(ctx, attacher);
+}
+
+static void detach_dataset(Context ctx, Runtime *runtime,
+                           PhysicalRegion attached, LogicalRegion file_region)
+{
+    // writes reach the file before the detach completes
+    runtime->detach_external_resource(ctx, attached).get_void_result();
+    runtime->destroy_logical_region(ctx, file_region);
+    runtime->destroy_field_space(ctx, file_region.get_field_space());
+}
+
+template<typename T>
+void read_hdf5(Context ctx, Runtime *runtime,
+               const std::string &file, const std::string &dataset,
+               LogicalRegion region, FieldID fid)
+{
+    Rect<1> rect = runtime->get_index_space_domain(ctx, region.get_index_space());
+    assert(rect.lo[0] == 0);
+    assert((long long)rect.volume() == hdf5_dataset_size<T>(file, dataset));
+    LogicalRegion file_region;
+    PhysicalRegion attached = attach_dataset<T>(ctx, runtime, file, dataset, region,
+                                                LEGION_FILE_READ_ONLY, file_region);
+    copy_pieces(ctx, runtime, file_region, FID_HDF5_KEY, region, fid);
+    detach_dataset(ctx, runtime, attached, file_region);
+}
+
+template<typename T>
+void write_hdf5(Context ctx, Runtime *runtime,
+                LogicalRegion region, FieldID fid,
+                const std::string &file, const std::string &dataset)
+{
+    Rect<1> rect = runtime->get_index_space_domain(ctx, region.get_index_space());
+    assert(rect.lo[0] == 0);
+    create_dataset<T>(file, dataset, rect.volume());
+    LogicalRegion file_region;
+    PhysicalRegion attached = attach_dataset<T>(ctx, runtime, file, dataset, region,
+                                                LEGION_FILE_READ_WRITE, file_region);
+    copy_pieces(ctx, runtime, region, fid, file_region, FID_HDF5_KEY);
+    detach_dataset(ctx, runtime, attached, file_region);
+}
+
+#else
+
+static void hdf5_unavailable()
+{
+    fprintf(stderr, "HDF5 datasets need Legion built with USE_HDF=1\n");
+    exit(1);
+}
+
+template<typename T>
+long long hdf5_dataset_size(const std::string &, const std::string &)
+{
+    hdf5_unavailable();
+    return 0;
+}
+
+template<typename T>
+void read_hdf5(Context, Runtime *, const std::string &, const std::string &,
+               LogicalRegion, FieldID)
+{
+    hdf5_unavailable();
+}
+
+template<typename T>
+void write_hdf5(Context, Runtime *, LogicalRegion, FieldID,
+                const std::string &, const std::string &)
+{
+    hdf5_unavailable();
+}
+
+#endif
+
+template long long hdf5_dataset_size<int>(const std::string &, const std::string &);
+template void read_hdf5<int>(Context, Runtime *, const std::string &, const std::string &,
+                             LogicalRegion, FieldID);
+template void write_hdf5<int>(Context, Runtime *, LogicalRegion, FieldID,
+                              const std::string &, const std::string &);
+template long long hdf5_dataset_size<int16_t>(const std::string &, const std::string &);
+template void read_hdf5<int16_t>(Context, Runtime *, const std::string &, const std::string &,
+                                 LogicalRegion, FieldID);
+template void write_hdf5<int16_t>(Context, Runtime *, LogicalRegion, FieldID,
+                                  const std::string &, const std::string &);
+template long long hdf5_dataset_size<uint16_t>(const std::string &, const std::string &);
+template void read_hdf5<uint16_t>(Context, Runtime *, const std::string &, const std::string &,
+                                  LogicalRegion, FieldID);
+template void write_hdf5<uint16_t>(Context, Runtime *, LogicalRegion, FieldID,
+                                   const std::string &, const std::string &);
+template long long hdf5_dataset_size<uint8_t>(const std::string &, const std::string &);
+template void read_hdf5<uint8_t>(Context, Runtime *, const std::string &, const std::string &,
+                                 LogicalRegion, FieldID);
+template void write_hdf5<uint8_t>(Context, Runtime *, LogicalRegion, FieldID,
+                                  const std::string &, const std::string &);
+
+} // namespace bitonic
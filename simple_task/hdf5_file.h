@@ -0,0 +1,39 @@
+// HDF5 datasets of keys
+// A 1-D dataset is attached to a region of its own with Legion's HDF5
+// support, and copied into or out of the region being sorted by an index
+// copy over an equal partition, so the pieces of the dataset are read and
+// written in parallel. Needs Legion built with USE_HDF=1.
+
+#ifndef BITONIC_HDF5_FILE_H
+#define BITONIC_HDF5_FILE_H
+
+#include <string>
+#include "bitonic.h"
+
+namespace bitonic {
+
+// Split "file.h5:/dataset" into the file and the dataset path,
+// false if `path` does not name a dataset
+bool parse_hdf5_path(const char *path, std::string &file, std::string &dataset);
+
+// Number of keys of a 1-D dataset of keys of type T
+template<typename T>
+long long hdf5_dataset_size(const std::string &file, const std::string &dataset);
+
+// Copy the dataset into `fid` of `region`, whose index space must have
+// as many points as the dataset has keys
+template<typename T>
+void read_hdf5(Legion::Context ctx, Legion::Runtime *runtime,
+               const std::string &file, const std::string &dataset,
+               Legion::LogicalRegion region, Legion::FieldID fid);
+
+// Copy `fid` of `region` into the dataset, which is created or replaced,
+// the file is created if it does not exist
+template<typename T>
+void write_hdf5(Legion::Context ctx, Legion::Runtime *runtime,
+                Legion::LogicalRegion region, Legion::FieldID fid,
+                const std::string &file, const std::string &dataset);
+
+} // namespace bitonic
+
+#endif // BITONIC_HDF5_FILE_H
@@ -0,0 +1,460 @@
+// Asynchronous file input and output of the sorter
+// The io_uring rings are set up with raw system calls, so no liburing is
+// needed. When the kernel or the sandbox refuses io_uring_setup, or the
+// buffers cannot be registered, the files are read and written with
+// pread/pwrite or unregistered io_uring operations instead.
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "io.h"
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define BITONIC_HAVE_URING 1
+#else
+#define BITONIC_HAVE_URING 0
+#endif
+
+namespace bitonic {
+
+static const size_t BUFFER_ALIGN = 4096;
+
+static void io_error(const char *what, int err)
+{
+    fprintf(stderr, "%s: %s\n", what, strerror(err));
+    exit(1);
+}
+
+static int open_file(const char *path, int flags)
+{
+    int fd = ::open(path, flags, 0644);
+    if (fd < 0) {
+        io_error(path, errno);
+    }
+    return fd;
+}
+
+static size_t file_size(const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        io_error(path, errno);
+    }
+    return st.st_size;
+}
+
+static char *alloc_buffer(size_t bytes)
+{
+    bytes = (bytes + BUFFER_ALIGN - 1) / BUFFER_ALIGN * BUFFER_ALIGN;
+    char *buffer = (char *)aligned_alloc(BUFFER_ALIGN, bytes);
+    assert(buffer != NULL);
+    return buffer;
+}
+
+// pread/pwrite until all bytes are transferred
+static void pread_full(int fd, char *dst, size_t bytes, off_t offset)
+{
+    while (bytes > 0) {
+        ssize_t n = pread(fd, dst, bytes, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            io_error("pread", n < 0 ? errno : EIO);
+        }
+        dst += n;
+        bytes -= n;
+        offset += n;
+    }
+}
+
+static void pwrite_full(int fd, const char *src, size_t bytes, off_t offset)
+{
+    while (bytes > 0) {
+        ssize_t n = pwrite(fd, src, bytes, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            io_error("pwrite", n < 0 ? errno : EIO);
+        }
+        src += n;
+        bytes -= n;
+        offset += n;
+    }
+}
+
+#if BITONIC_HAVE_URING
+
+struct Ring {
+    int fd;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    io_uring_sqe *sqes;
+    io_uring_cqe *cqes;
+    void *sq_ptr;
+    size_t sq_bytes;
+    void *cq_ptr;
+    size_t cq_bytes;
+    size_t sqes_bytes;
+    // buffers are registered, use the fixed operations
+    bool fixed;
+};
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+// NULL when io_uring is not available
+static Ring *ring_create(unsigned entries, const std::vector<char *> &buffers,
+                         size_t buffer_bytes)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0) {
+        return NULL;
+    }
+    Ring *ring = new Ring();
+    ring->fd = fd;
+    ring->sq_bytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_bytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->sq_bytes = ring->cq_bytes = std::max(ring->sq_bytes, ring->cq_bytes);
+    }
+    ring->sq_ptr = mmap(NULL, ring->sq_bytes, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_bytes, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    }
+    ring->sqes_bytes = params.sq_entries * sizeof(io_uring_sqe);
+    ring->sqes = (io_uring_sqe *)mmap(NULL, ring->sqes_bytes, PROT_READ | PROT_WRITE,
+                                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    assert(ring->sq_ptr != MAP_FAILED && ring->cq_ptr != MAP_FAILED);
+    assert(ring->sqes != MAP_FAILED);
+
+    char *sq = (char *)ring->sq_ptr;
+    char *cq = (char *)ring->cq_ptr;
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    // registered buffers save the page pinning of every operation,
+    // registration fails when they exceed RLIMIT_MEMLOCK
+    std::vector<iovec> iovecs(buffers.size());
+    for (size_t i = 0; i < buffers.size(); i++) {
+        iovecs[i].iov_base = buffers[i];
+        iovecs[i].iov_len = buffer_bytes;
+    }
+    ring->fixed = syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS,
+                          iovecs.data(), (unsigned)iovecs.size()) == 0;
+    return ring;
+}
+
+static void ring_destroy(Ring *ring)
+{
+    munmap(ring->sqes, ring->sqes_bytes);
+    if (ring->cq_ptr != ring->sq_ptr) {
+        munmap(ring->cq_ptr, ring->cq_bytes);
+    }
+    munmap(ring->sq_ptr, ring->sq_bytes);
+    close(ring->fd);
+    delete ring;
+}
+
+// Queue a read or write of buffer `index` and submit it right away
+static void ring_submit(Ring *ring, bool write, int fd, char *buffer, int index,
+                        size_t bytes, off_t offset)
+{
+    unsigned tail = *ring->sq_tail;
+    unsigned slot = tail & *ring->sq_mask;
+    io_uring_sqe *sqe = &ring->sqes[slot];
+    memset(sqe, 0, sizeof(*sqe));
+    if (ring->fixed) {
+        sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->buf_index = index;
+    } else {
+        sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+    }
+    sqe->fd = fd;
+    sqe->addr = (unsigned long long)buffer;
+    sqe->len = bytes;
+    sqe->off = offset;
+    sqe->user_data = index;
+    ring->sq_array[slot] = slot;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    while (uring_enter(ring->fd, 1, 0, 0) < 0) {
+        if (errno != EINTR && errno != EAGAIN) {
+            io_error("io_uring_enter", errno);
+        }
+    }
+}
+
+// Wait for the next completion, returns the buffer index and its result
+static int ring_complete(Ring *ring, int &result)
+{
+    for (;;) {
+        unsigned head = *ring->cq_head;
+        if (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            int index = cqe->user_data;
+            result = cqe->res;
+            __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+            return index;
+        }
+        if (uring_enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+            io_error("io_uring_enter", errno);
+        }
+    }
+}
+
+#else
+
+struct Ring {
+};
+
+static Ring *ring_create(unsigned, const std::vector<char *> &, size_t)
+{
+    return NULL;
+}
+
+static void ring_destroy(Ring *) {}
+
+static void ring_submit(Ring *, bool, int, char *, int, size_t, off_t)
+{
+    assert(false);
+}
+
+static int ring_complete(Ring *, int &)
+{
+    assert(false);
+    return 0;
+}
+
+#endif // BITONIC_HAVE_URING
+
+ChunkReader::ChunkReader(const char *path, const IoOptions &options)
+    : ChunkReader(path, 0, file_size(path), options)
+{
+}
+
+ChunkReader::ChunkReader(const char *path, off_t offset, size_t length,
+                         const IoOptions &options)
+    : options(options), offset(offset), length(length),
+      next_submit(0), next_chunk(0), ring(NULL)
+{
+    assert(options.chunk_bytes > 0 && options.queue_depth > 0);
+    fd = open_file(path, O_RDONLY);
+    num_chunks = (length + options.chunk_bytes - 1) / options.chunk_bytes;
+    size_t num_buffers = std::min<size_t>(options.queue_depth, std::max<size_t>(num_chunks, 1));
+    for (size_t i = 0; i < num_buffers; i++) {
+        buffers.push_back(alloc_buffer(options.chunk_bytes));
+    }
+    done.resize(num_buffers, false);
+    if (options.use_uring && num_chunks > 0) {
+        ring = ring_create(num_buffers, buffers, options.chunk_bytes);
+    }
+    while (next_submit < std::min(num_chunks, num_buffers)) {
+        submit(next_submit++);
+    }
+}
+
+ChunkReader::~ChunkReader()
+{
+    if (ring != NULL) {
+        // the kernel may still write to the buffers of submitted chunks
+        for (size_t chunk = next_chunk; chunk < next_submit; chunk++) {
+            wait(chunk);
+        }
+        ring_destroy(ring);
+    }
+    close(fd);
+    for (char *buffer : buffers) {
+        free(buffer);
+    }
+}
+
+size_t ChunkReader::chunk_bytes(size_t chunk) const
+{
+    return std::min(options.chunk_bytes, length - chunk * options.chunk_bytes);
+}
+
+void ChunkReader::submit(size_t chunk)
+{
+    int index = chunk % buffers.size();
+    done[index] = false;
+    if (ring != NULL) {
+        ring_submit(ring, false, fd, buffers[index], index, chunk_bytes(chunk),
+                    offset + chunk * options.chunk_bytes);
+    }
+}
+
+void ChunkReader::wait(size_t chunk)
+{
+    int index = chunk % buffers.size();
+    off_t chunk_offset = offset + chunk * options.chunk_bytes;
+    if (ring == NULL) {
+        pread_full(fd, buffers[index], chunk_bytes(chunk), chunk_offset);
+        done[index] = true;
+        return;
+    }
+    while (!done[index]) {
+        int result;
+        int other = ring_complete(ring, result);
+        if (result < 0) {
+            io_error("read", -result);
+        }
+        // chunks in flight are next_chunk .. next_submit - 1,
+        // one per buffer, so the buffer index gives the chunk
+        size_t other_chunk = next_chunk + (other - next_chunk % buffers.size()
+                                           + buffers.size()) % buffers.size();
+        size_t bytes = chunk_bytes(other_chunk);
+        if ((size_t)result < bytes) {
+            // short read, finish the chunk synchronously
+            pread_full(fd, buffers[other] + result, bytes - result,
+                       offset + other_chunk * options.chunk_bytes + result);
+        }
+        done[other] = true;
+    }
+}
+
+const char *ChunkReader::next(size_t &bytes)
+{
+    // the previous chunk is consumed, reuse its buffer
+    if (next_chunk > 0 && next_submit < num_chunks) {
+        submit(next_submit++);
+    }
+    if (next_chunk == num_chunks) {
+        bytes = 0;
+        return NULL;
+    }
+    wait(next_chunk);
+    bytes = chunk_bytes(next_chunk);
+    return buffers[next_chunk++ % buffers.size()];
+}
+
+void ChunkReader::read_all(void *dst)
+{
+    char *out = (char *)dst;
+    size_t bytes;
+    while (const char *chunk = next(bytes)) {
+        memcpy(out, chunk, bytes);
+        out += bytes;
+    }
+}
+
+ChunkWriter::ChunkWriter(const char *path, const IoOptions &options)
+    : options(options), written(0), filled(0), offset(0), current(0), ring(NULL)
+{
+    assert(options.chunk_bytes > 0 && options.queue_depth > 0);
+    fd = open_file(path, O_WRONLY | O_CREAT | O_TRUNC);
+    for (int i = 0; i < options.queue_depth; i++) {
+        buffers.push_back(alloc_buffer(options.chunk_bytes));
+    }
+    in_flight.resize(buffers.size(), false);
+    offsets.resize(buffers.size(), 0);
+    lengths.resize(buffers.size(), 0);
+    if (options.use_uring) {
+        ring = ring_create(buffers.size(), buffers, options.chunk_bytes);
+    }
+}
+
+ChunkWriter::~ChunkWriter()
+{
+    if (fd >= 0) {
+        finish();
+    }
+    if (ring != NULL) {
+        ring_destroy(ring);
+    }
+    for (char *buffer : buffers) {
+        free(buffer);
+    }
+}
+
+void ChunkWriter::write(const void *src, size_t bytes)
+{
+    assert(fd >= 0);
+    const char *in = (const char *)src;
+    written += bytes;
+    while (bytes > 0) {
+        size_t n = std::min(bytes, options.chunk_bytes - filled);
+        memcpy(buffers[current] + filled, in, n);
+        filled += n;
+        in += n;
+        bytes -= n;
+        if (filled == options.chunk_bytes) {
+            flush();
+        }
+    }
+}
+
+void ChunkWriter::flush()
+{
+    if (filled == 0) {
+        return;
+    }
+    offsets[current] = offset;
+    lengths[current] = filled;
+    if (ring != NULL) {
+        in_flight[current] = true;
+        ring_submit(ring, true, fd, buffers[current], current, filled, offset);
+    } else {
+        pwrite_full(fd, buffers[current], filled, offset);
+    }
+    offset += filled;
+    filled = 0;
+    current = (current + 1) % buffers.size();
+    wait(current);
+}
+
+void ChunkWriter::wait(int buffer)
+{
+    while (in_flight[buffer]) {
+        int result;
+        int other = ring_complete(ring, result);
+        if (result < 0) {
+            io_error("write", -result);
+        }
+        if ((size_t)result < lengths[other]) {
+            // short write, finish the chunk synchronously
+            pwrite_full(fd, buffers[other] + result, lengths[other] - result,
+                        offsets[other] + result);
+        }
+        in_flight[other] = false;
+    }
+}
+
+void ChunkWriter::finish()
+{
+    flush();
+    for (size_t i = 0; i < buffers.size(); i++) {
+        wait(i);
+    }
+    close(fd);
+    fd = -1;
+}
+
+} // namespace bitonic
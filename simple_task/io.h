@@ -0,0 +1,104 @@
+// Asynchronous file input and output of the sorter
+// Files are read and written in fixed-size chunks with several chunks in
+// flight, through io_uring with registered buffers when the kernel has it,
+// so the next chunk is transferred while the caller works on the current
+// one. Without io_uring the chunks are read and written with pread/pwrite.
+
+#ifndef BITONIC_IO_H
+#define BITONIC_IO_H
+
+#include <cstddef>
+#include <vector>
+#include <sys/types.h>
+
+namespace bitonic {
+
+const size_t DEFAULT_CHUNK_BYTES = 1 << 20;
+const int DEFAULT_QUEUE_DEPTH = 8;
+
+struct IoOptions {
+    size_t chunk_bytes = DEFAULT_CHUNK_BYTES;
+    // chunks in flight
+    int queue_depth = DEFAULT_QUEUE_DEPTH;
+    // use pread/pwrite even when io_uring is available
+    bool use_uring = true;
+};
+
+// Submission and completion rings of one io_uring instance, see io.cc
+struct Ring;
+
+// Reads `length` bytes of a file from `offset` on, in file order
+class ChunkReader {
+public:
+    // reads the whole file
+    ChunkReader(const char *path, const IoOptions &options = IoOptions());
+    ChunkReader(const char *path, off_t offset, size_t length,
+                const IoOptions &options = IoOptions());
+    ~ChunkReader();
+
+    size_t size() const { return length; }
+    bool async() const { return ring != NULL; }
+
+    // The next chunk, or NULL after the last one. The chunk stays valid
+    // until the next call, which hands its buffer back to the queue.
+    const char *next(size_t &bytes);
+
+    // Read the remaining bytes to dst
+    void read_all(void *dst);
+
+private:
+    void submit(size_t chunk);
+    void wait(size_t chunk);
+    size_t chunk_bytes(size_t chunk) const;
+
+    IoOptions options;
+    int fd;
+    off_t offset;
+    size_t length;
+    size_t num_chunks;
+    // the next chunk to submit and to return
+    size_t next_submit;
+    size_t next_chunk;
+    std::vector<char *> buffers;
+    // the chunk in each buffer has arrived
+    std::vector<bool> done;
+    Ring *ring;
+};
+
+// Writes a file sequentially from its start
+class ChunkWriter {
+public:
+    ChunkWriter(const char *path, const IoOptions &options = IoOptions());
+    ~ChunkWriter();
+
+    // copies src, it may be reused when write() returns
+    void write(const void *src, size_t bytes);
+    // flush the last chunk, wait for all writes and close the file
+    void finish();
+
+    size_t size() const { return written; }
+    bool async() const { return ring != NULL; }
+
+private:
+    void flush();
+    void wait(int buffer);
+
+    IoOptions options;
+    int fd;
+    // bytes passed to write()
+    size_t written;
+    // bytes of the current buffer and its file offset
+    size_t filled;
+    off_t offset;
+    int current;
+    std::vector<char *> buffers;
+    // file range of the write in flight from each buffer, if any
+    std::vector<bool> in_flight;
+    std::vector<off_t> offsets;
+    std::vector<size_t> lengths;
+    Ring *ring;
+};
+
+} // namespace bitonic
+
+#endif // BITONIC_IO_H
@@ -0,0 +1,291 @@
+// Applying a sort order to payload columns
+
+#include <algorithm>
+#include <cassert>
+#include <type_traits>
+#include "permute.h"
+#include "search.h"
+#include "stats.h"
+
+using namespace Legion;
+
+namespace bitonic {
+
+static TaskID split_task_id;
+static TaskID fill_task_id;
+
+// Arguments of a split task
+struct SplitArgs {
+    // blocks are 1 << shift rows
+    int shift;
+    int num_blocks;
+    FieldID dest_fid;
+};
+
+template<typename T>
+void sort_positions(const T *keys, const T *sorted, int n, long long *dest)
+{
+    // equal keys take the positions from their first one on, in input order
+    SearchIndex<T> index;
+    index.build(sorted, n);
+    std::vector<int> positions(n), taken(n, 0);
+    index.lower_bound_batch(keys, n, positions.data());
+    for (int i = 0; i < n; i++) {
+        int pos = positions[i];
+        dest[i] = pos + taken[pos]++;
+    }
+}
+
+// rows of wider fields are copied by fixed-size memcpy too
+template<size_t W>
+struct RowBytes {
+    char bytes[W];
+};
+
+// out[to[j]] = in[from[j]] for n rows, j itself without `from` or `to`
+template<typename Row>
+static void move_rows(const char *in, char *out, const int *from, const int *to, int n)
+{
+    for (int j = 0; j < n; j++) {
+        Row row;
+        memcpy(&row, in + sizeof(Row) * (from ? from[j] : j), sizeof(Row));
+        memcpy(out + sizeof(Row) * (to ? to[j] : j), &row, sizeof(Row));
+    }
+}
+
+static void move_rows(const char *in, char *out, size_t width,
+                      const int *from, const int *to, int n)
+{
+    switch (width) {
+    case 1:
+        move_rows<uint8_t>(in, out, from, to, n);
+        break;
+    case 2:
+        move_rows<uint16_t>(in, out, from, to, n);
+        break;
+    case 4:
+        move_rows<uint32_t>(in, out, from, to, n);
+        break;
+    case 8:
+        move_rows<uint64_t>(in, out, from, to, n);
+        break;
+    case 16:
+        move_rows<RowBytes<16>>(in, out, from, to, n);
+        break;
+    case 24:
+        move_rows<RowBytes<24>>(in, out, from, to, n);
+        break;
+    case 32:
+        move_rows<RowBytes<32>>(in, out, from, to, n);
+        break;
+    default:
+        for (int j = 0; j < n; j++) {
+            memcpy(out + width * (to ? to[j] : j), in + width * (from ? from[j] : j), width);
+        }
+        break;
+    }
+}
+
+// first row of field `fid` of a block, fields may be of any width,
+// read-only blocks give const rows
+template<PrivilegeMode MODE>
+static std::conditional_t<MODE == READ_ONLY, const char *, char *>
+block_rows(Runtime *runtime, const PhysicalRegion &region,
+           const RegionRequirement &req, FieldID fid, Point<1> lo)
+{
+    size_t width = runtime->get_field_size(req.region.get_field_space(), fid);
+    const FieldAccessor<MODE, char, 1, coord_t, Realm::AffineAccessor<char, 1, coord_t>>
+        rows(region, fid, width);
+    return rows.ptr(lo);
+}
+
+// Copy a block of the input to its piece of the staging copy, grouped by
+// the output block of each row, and return the rows of each group
+MyVec<int> split_task(const Task *task,
+                      const std::vector<PhysicalRegion> &regions,
+                      Context ctx, Runtime *runtime)
+{
+    TaskTimer timer(task);
+    assert(regions.size() == 2);
+    assert(task->arglen == sizeof(SplitArgs));
+    auto args = (const SplitArgs *)(task->args);
+    Rect<1> rect = runtime->get_index_space_domain(ctx,
+            task->regions[0].region.get_index_space());
+    int n = rect.volume();
+    MyVec<int> counts(args->num_blocks);
+    if (n == 0) {
+        return counts;
+    }
+    const long long *dest = (const long long *)block_rows<READ_ONLY>(
+            runtime, regions[0], task->regions[0], args->dest_fid, rect.lo);
+
+    // a stable counting sort of the rows by output block, the rows are
+    // read in order and written within the piece, which stays in the cache
+    for (int r = 0; r < n; r++) {
+        counts[dest[r] >> args->shift]++;
+    }
+    std::vector<int> starts(args->num_blocks, 0);
+    for (int b = 1; b < args->num_blocks; b++) {
+        starts[b] = starts[b - 1] + counts[b - 1];
+    }
+    std::vector<int> to(n);
+    for (int r = 0; r < n; r++) {
+        to[r] = starts[dest[r] >> args->shift]++;
+    }
+
+    // the destinations move with the columns
+    for (FieldID fid : task->regions[1].privilege_fields) {
+        size_t width = runtime->get_field_size(task->regions[1].region.get_field_space(), fid);
+        move_rows(block_rows<READ_ONLY>(runtime, regions[0], task->regions[0], fid, rect.lo),
+                  block_rows<WRITE_DISCARD>(runtime, regions[1], task->regions[1], fid, rect.lo),
+                  width, NULL, to.data(), n);
+    }
+    return counts;
+}
+
+// Fill a block of the output from its runs in the staging copy, the local
+// arguments hold the first row and the length of each run
+void fill_task(const Task *task,
+               const std::vector<PhysicalRegion> &regions,
+               Context ctx, Runtime *runtime)
+{
+    TaskTimer timer(task);
+    assert(regions.size() == 2);
+    assert(task->arglen == sizeof(SplitArgs));
+    auto args = (const SplitArgs *)(task->args);
+    Rect<1> rect = runtime->get_index_space_domain(ctx,
+            task->regions[1].region.get_index_space());
+    if (rect.empty()) {
+        return;
+    }
+    assert(task->local_arglen % (2 * sizeof(long long)) == 0);
+    auto runs = (const long long *)task->local_args;
+    int num_runs = task->local_arglen / (2 * sizeof(long long));
+    const long long *dest = (const long long *)block_rows<READ_ONLY>(
+            runtime, regions[0], task->regions[0], args->dest_fid, 0);
+
+    // staged rows of the block, and their rows in the block
+    std::vector<int> from, to;
+    from.reserve(rect.volume());
+    to.reserve(rect.volume());
+    for (int s = 0; s < num_runs; s++) {
+        for (long long k = runs[2 * s]; k < runs[2 * s] + runs[2 * s + 1]; k++) {
+            from.push_back(k);
+            to.push_back(dest[k] - rect.lo[0]);
+        }
+    }
+    assert(from.size() == rect.volume());
+
+    for (FieldID fid : task->regions[1].privilege_fields) {
+        size_t width = runtime->get_field_size(task->regions[1].region.get_field_space(), fid);
+        move_rows(block_rows<READ_ONLY>(runtime, regions[0], task->regions[0], fid, 0),
+                  block_rows<WRITE_DISCARD>(runtime, regions[1], task->regions[1], fid, rect.lo),
+                  width, from.data(), to.data(), from.size());
+    }
+}
+
+void register_permute_tasks(TaskID base)
+{
+    split_task_id = base;
+    fill_task_id = base + 1;
+    {
+        TaskVariantRegistrar registrar(split_task_id, "split");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<MyVec<int>, split_task>(registrar, "split");
+    }
+
+    {
+        TaskVariantRegistrar registrar(fill_task_id, "fill");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<fill_task>(registrar, "fill");
+    }
+}
+
+void apply_permutation(Context ctx, Runtime *runtime,
+                       LogicalRegion src, LogicalRegion dst,
+                       const std::vector<FieldID> &fields, FieldID dest_fid, int block)
+{
+    assert(block > 0 && !fields.empty());
+    Rect<1> rect = runtime->get_index_space_domain(ctx, src.get_index_space());
+    Rect<1> dst_rect = runtime->get_index_space_domain(ctx, dst.get_index_space());
+    assert(rect.lo[0] == 0 && dst_rect.lo[0] == 0 && rect.volume() == dst_rect.volume());
+    long long num_rows = rect.volume();
+    int shift = 0;
+    while ((1LL << shift) < block || (num_rows >> shift) >= MAX_SCATTER_BLOCKS) {
+        shift++;
+    }
+    long long rows_per_block = 1LL << shift;
+    SplitArgs args {shift, (int)((num_rows + rows_per_block - 1) / rows_per_block), dest_fid};
+
+    IndexPartition src_ip = runtime->create_partition_by_blockify(ctx,
+            IndexSpaceT<1>(src.get_index_space()), Point<1>(rows_per_block));
+    IndexPartition dst_ip = runtime->create_partition_by_blockify(ctx,
+            IndexSpaceT<1>(dst.get_index_space()), Point<1>(rows_per_block));
+    IndexSpace colors = runtime->get_index_partition_color_space_name(ctx, src_ip);
+    LogicalRegion staging = runtime->create_logical_region(ctx, src.get_index_space(),
+                                                           src.get_field_space());
+
+    // split the input blocks into the staging copy
+    IndexTaskLauncher split(split_task_id, colors, TaskArgument(&args, sizeof(args)),
+                            ArgumentMap());
+    split.add_region_requirement(RegionRequirement(runtime->get_logical_partition(ctx, src, src_ip),
+                                                   0, READ_ONLY, EXCLUSIVE, src));
+    split.add_region_requirement(RegionRequirement(runtime->get_logical_partition(ctx, staging, src_ip),
+                                                   0, WRITE_DISCARD, EXCLUSIVE, staging));
+    split.region_requirements[0].add_field(dest_fid);
+    split.region_requirements[1].add_field(dest_fid);
+    for (FieldID fid : fields) {
+        split.region_requirements[0].add_field(fid);
+        split.region_requirements[1].add_field(fid);
+    }
+    FutureMap counts = runtime->execute_index_space(ctx, split);
+
+    // output block b reads the b-th group of every piece of the staging copy
+    ArgumentMap runs;
+    {
+        std::vector<std::vector<long long>> block_runs(args.num_blocks);
+        for (int s = 0; s < args.num_blocks; s++) {
+            MyVec<int> piece;
+            {
+                BlockedTimer timer;
+                piece = counts.get_result<MyVec<int>>(DomainPoint(Point<1>(s)));
+            }
+            long long start = s * rows_per_block;
+            for (int b = 0; b < args.num_blocks; b++) {
+                block_runs[b].push_back(start);
+                block_runs[b].push_back(piece[b]);
+                start += piece[b];
+            }
+        }
+        for (int b = 0; b < args.num_blocks; b++) {
+            runs.set_point(DomainPoint(Point<1>(b)),
+                           TaskArgument(block_runs[b].data(), sizeof(long long) * block_runs[b].size()));
+        }
+    }
+
+    IndexTaskLauncher fill(fill_task_id, colors, TaskArgument(&args, sizeof(args)), runs);
+    // the runs of a block are spread over the staging copy
+    fill.add_region_requirement(RegionRequirement(staging, 0, READ_ONLY, EXCLUSIVE, staging));
+    fill.add_region_requirement(RegionRequirement(runtime->get_logical_partition(ctx, dst, dst_ip),
+                                                  0, WRITE_DISCARD, EXCLUSIVE, dst));
+    fill.region_requirements[0].add_field(dest_fid);
+    for (FieldID fid : fields) {
+        fill.region_requirements[0].add_field(fid);
+        fill.region_requirements[1].add_field(fid);
+    }
+    FutureMap done = runtime->execute_index_space(ctx, fill);
+    {
+        BlockedTimer timer;
+        done.wait_all_results();
+    }
+    runtime->destroy_logical_region(ctx, staging);
+}
+
+template void sort_positions<int>(const int *, const int *, int, long long *);
+template void sort_positions<int16_t>(const int16_t *, const int16_t *, int, long long *);
+template void sort_positions<uint16_t>(const uint16_t *, const uint16_t *, int, long long *);
+template void sort_positions<uint8_t>(const uint8_t *, const uint8_t *, int, long long *);
+
+} // namespace bitonic
@@ -0,0 +1,47 @@
+// Applying a sort order to payload columns
+// Moving each row of a column to its sorted position is a random scatter
+// over the whole output, with a cache miss and often a TLB miss per row.
+// The rows are moved in two passes instead, as in a radix sort. The first
+// pass splits each block of input rows by the output block the rows go
+// to, into a staging copy of the input. The second pass fills each output
+// block from its runs in the staging copy, reading every run in order and
+// writing only within the block, which stays in the cache. Each pass is an
+// index launch over the blocks, and the split of a block is computed once
+// and reused for every column.
+
+#ifndef BITONIC_PERMUTE_H
+#define BITONIC_PERMUTE_H
+
+#include <vector>
+#include "bitonic.h"
+
+namespace bitonic {
+
+// Rows of a block of the input or the output, rounded up to a power of 2
+const int DEFAULT_SCATTER_BLOCK = 1 << 16;
+
+// Blocks are made larger when there would be more than this many, every
+// output block reads a run from each input block
+const int MAX_SCATTER_BLOCKS = 1024;
+
+// Sorted position of each of the n keys of `keys`, given the keys in
+// sorted order. Equal keys keep their input order.
+template<typename T>
+void sort_positions(const T *keys, const T *sorted, int n, long long *dest);
+
+// Register the split and fill tasks with the ids from `base` on,
+// called by register_tasks()
+void register_permute_tasks(Legion::TaskID base);
+
+// Move row i of `fields` of `src` to row dest[i] of the same fields of
+// `dst`, where `dest_fid` is a long long field of `src`. Both regions have
+// rows 0 to n - 1, and the fields may be of any width. The staging copy
+// takes as much memory as the fields of `src`.
+void apply_permutation(Legion::Context ctx, Legion::Runtime *runtime,
+                       Legion::LogicalRegion src, Legion::LogicalRegion dst,
+                       const std::vector<Legion::FieldID> &fields, Legion::FieldID dest_fid,
+                       int block = DEFAULT_SCATTER_BLOCK);
+
+} // namespace bitonic
+
+#endif // BITONIC_PERMUTE_H
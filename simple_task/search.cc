@@ -0,0 +1,219 @@
+// Search index over sorted keys
+
+#include <cassert>
+#include "search.h"
+#include "stats.h"
+
+using namespace Legion;
+
+namespace bitonic {
+
+static TaskID search_task_base;
+
+template<typename T>
+static TaskID search_task_id()
+{
+    return search_task_base + KeyTraits<T>::type;
+}
+
+enum {
+    FID_SEARCH_KEY,
+    FID_SEARCH_RANK,
+};
+
+// Arguments of a build_index task
+struct BuildIndexArgs {
+    int num_keys;
+};
+
+// number of slots of the subtree rooted at slot k
+static long long subtree_size(long long k, long long n)
+{
+    long long size = 0;
+    for (long long lo = k, hi = k; lo <= n; lo = 2 * lo, hi = 2 * hi + 1) {
+        size += std::min(hi, n) - lo + 1;
+    }
+    return size;
+}
+
+// Sorted position of the key in slot k: the keys of its left subtree,
+// and of every ancestor it is right of with that ancestor's left subtree,
+// come before it
+static long long slot_rank(long long k, long long n)
+{
+    long long rank = subtree_size(2 * k, n);
+    for (; k > 1; k /= 2) {
+        if (k % 2 == 1) {
+            rank += subtree_size(k - 1, n) + 1;
+        }
+    }
+    return rank;
+}
+
+// Fill a block of slots of the index, slot k is stored at k - 1
+template<typename T>
+void build_index_task(const Task *task,
+                      const std::vector<PhysicalRegion> &regions,
+                      Context ctx, Runtime *runtime)
+{
+    TaskTimer timer(task);
+    assert(task->arglen == sizeof(BuildIndexArgs));
+    auto args = (const BuildIndexArgs *)(task->args);
+    assert(task->regions[0].privilege_fields.size() == 1);
+    FieldID fid = *task->regions[0].privilege_fields.begin();
+    const FieldAccessor<READ_ONLY, T, 1> sorted(regions[0], fid);
+    const FieldAccessor<WRITE_DISCARD, T, 1> keys(regions[1], FID_SEARCH_KEY);
+    const FieldAccessor<WRITE_DISCARD, int, 1> ranks(regions[1], FID_SEARCH_RANK);
+    Rect<1> rect = runtime->get_index_space_domain(ctx,
+            task->regions[1].region.get_index_space());
+    for (PointInRectIterator<1> pir(rect); pir(); pir++) {
+        long long rank = slot_rank(*pir + 1, args->num_keys);
+        keys[*pir] = sorted[rank];
+        ranks[*pir] = rank;
+    }
+}
+
+template<typename T>
+void SearchIndex<T>::build(Context ctx, Runtime *runtime,
+                           LogicalRegion sorted, FieldID fid, int num_keys, int block)
+{
+    assert(num_keys > 0 && block > 0);
+    IndexSpace is = runtime->create_index_space(ctx, Rect<1>(0, num_keys - 1));
+    FieldSpace fs = runtime->create_field_space(ctx);
+    {
+        FieldAllocator allocator = runtime->create_field_allocator(ctx, fs);
+        allocator.allocate_field(sizeof(T), FID_SEARCH_KEY);
+        allocator.allocate_field(sizeof(int), FID_SEARCH_RANK);
+    }
+    LogicalRegion index = runtime->create_logical_region(ctx, is, fs);
+    int num_blocks = (num_keys + block - 1) / block;
+    IndexSpace colors = runtime->create_index_space(ctx, Rect<1>(0, num_blocks - 1));
+    IndexPartition ip = runtime->create_equal_partition(ctx, is, colors);
+    runtime->destroy_index_space(ctx, colors);
+    LogicalPartition lp = runtime->get_logical_partition(ctx, index, ip);
+
+    // each task places the keys of its slots
+    BuildIndexArgs args {num_keys};
+    std::vector<Future> results;
+    for (int j = 0; j < num_blocks; j++) {
+        TaskLauncher launcher(search_task_id<T>(), TaskArgument(&args, sizeof(args)));
+        launcher.add_region_requirement(RegionRequirement(sorted, READ_ONLY, EXCLUSIVE, sorted));
+        launcher.region_requirements.back().add_field(fid);
+        LogicalRegion out = runtime->get_logical_subregion_by_color(ctx, lp,
+                DomainPoint(Point<1>(j)));
+        launcher.add_region_requirement(RegionRequirement(out, WRITE_DISCARD, EXCLUSIVE, index));
+        launcher.region_requirements.back().add_field(FID_SEARCH_KEY);
+        launcher.region_requirements.back().add_field(FID_SEARCH_RANK);
+        results.push_back(runtime->execute_task(ctx, launcher));
+    }
+    for (auto &result : results) {
+        timed_wait(result);
+    }
+
+    RegionRequirement req(index, READ_ONLY, EXCLUSIVE, index);
+    req.add_field(FID_SEARCH_KEY);
+    req.add_field(FID_SEARCH_RANK);
+    PhysicalRegion region = runtime->map_region(ctx, req);
+    region.wait_until_valid();
+    const FieldAccessor<READ_ONLY, T, 1, coord_t, Realm::AffineAccessor<T, 1, coord_t>>
+        index_keys(region, FID_SEARCH_KEY);
+    const FieldAccessor<READ_ONLY, int, 1, coord_t, Realm::AffineAccessor<int, 1, coord_t>>
+        index_ranks(region, FID_SEARCH_RANK);
+    this->num_keys = num_keys;
+    keys.resize(num_keys + 1);
+    ranks.resize(num_keys + 1);
+    memcpy(&keys[1], index_keys.ptr(0), sizeof(T) * num_keys);
+    memcpy(&ranks[1], index_ranks.ptr(0), sizeof(int) * num_keys);
+    runtime->unmap_region(ctx, region);
+    runtime->destroy_logical_region(ctx, index);
+    runtime->destroy_field_space(ctx, fs);
+    runtime->destroy_index_space(ctx, is);
+
+    full_levels = 0;
+    while ((2LL << full_levels) - 1 <= num_keys) {
+        full_levels++;
+    }
+}
+
+// in-order walk of the slots, returns the next sorted position
+template<typename T>
+static int fill_slots(const T *sorted, int n, size_t k, int i,
+                      std::vector<T> &keys, std::vector<int> &ranks)
+{
+    if (k <= (size_t)n) {
+        i = fill_slots(sorted, n, 2 * k, i, keys, ranks);
+        keys[k] = sorted[i];
+        ranks[k] = i++;
+        i = fill_slots(sorted, n, 2 * k + 1, i, keys, ranks);
+    }
+    return i;
+}
+
+template<typename T>
+void SearchIndex<T>::build(const T *sorted, int num_keys)
+{
+    this->num_keys = num_keys;
+    keys.resize(num_keys + 1);
+    ranks.resize(num_keys + 1);
+    fill_slots(sorted, num_keys, 1, 0, keys, ranks);
+    full_levels = 0;
+    while ((2LL << full_levels) - 1 <= num_keys) {
+        full_levels++;
+    }
+}
+
+template<typename T>
+void SearchIndex<T>::lower_bound_batch(const T *queries, int n, int *positions) const
+{
+    const size_t last = num_keys;
+    for (int lo = 0; lo < n; lo += SEARCH_BATCH) {
+        int m = std::min(SEARCH_BATCH, n - lo);
+        const T *q = queries + lo;
+        size_t k[SEARCH_BATCH];
+        for (int j = 0; j < m; j++) {
+            k[j] = 1;
+        }
+        // every search is still inside the tree on the full levels, so the
+        // steps of the batch are independent and their misses overlap
+        for (int level = 0; level < full_levels; level++) {
+            for (int j = 0; j < m; j++) {
+                __builtin_prefetch(keys.data() + std::min(k[j] * PREFETCH_STRIDE, last));
+                k[j] = 2 * k[j] + (keys[k[j]] < q[j]);
+            }
+        }
+        // at most one partial level is left
+        for (int j = 0; j < m; j++) {
+            size_t slot = k[j];
+            if (slot <= last) {
+                slot = 2 * slot + (keys[slot] < q[j]);
+            }
+            slot >>= __builtin_ffsll(~slot);
+            positions[lo + j] = slot == 0 ? num_keys : ranks[slot];
+        }
+    }
+}
+
+template<typename T>
+static void register_search_task()
+{
+    TaskVariantRegistrar registrar(search_task_id<T>(), "build_index");
+    registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+    registrar.set_leaf(true);
+    Runtime::preregister_task_variant<build_index_task<T>>(registrar, "build_index");
+}
+
+void register_search_tasks(TaskID base)
+{
+    search_task_base = base;
+    register_search_task<int>();
+    register_search_task<int16_t>();
+    register_search_task<uint16_t>();
+    register_search_task<uint8_t>();
+}
+
+template class SearchIndex<int>;
+template class SearchIndex<int16_t>;
+template class SearchIndex<uint16_t>;
+template class SearchIndex<uint8_t>;
+
+} // namespace bitonic
@@ -0,0 +1,80 @@
+// Search index over sorted keys
+// The keys are stored in Eytzinger (BFS) order: the root in slot 1 and the
+// children of slot k in slots 2k and 2k + 1. A lower_bound walks down from
+// the root touching one slot per level, and the slots of the next levels
+// are close together, so they can be prefetched. Batched queries step a
+// group of independent searches one level at a time, which keeps several
+// cache misses in flight.
+
+#ifndef BITONIC_SEARCH_H
+#define BITONIC_SEARCH_H
+
+#include <algorithm>
+#include <vector>
+#include "bitonic.h"
+
+namespace bitonic {
+
+// Slots of the index built by one task
+const int DEFAULT_SEARCH_BLOCK = 1 << 16;
+
+// Queries stepped together by lower_bound_batch()
+const int SEARCH_BATCH = 16;
+
+template<typename T>
+class SearchIndex {
+public:
+    // Build from keys sorted in `fid` of `sorted`, with one task
+    // per `block` slots of the index
+    void build(Legion::Context ctx, Legion::Runtime *runtime,
+               Legion::LogicalRegion sorted, Legion::FieldID fid,
+               int num_keys, int block = DEFAULT_SEARCH_BLOCK);
+    // Build locally
+    void build(const T *sorted, int num_keys);
+
+    int size() const { return num_keys; }
+
+    // position of the first key not less than `key`
+    int lower_bound(T key) const {
+        size_t k = lower_bound_slot(key);
+        return k == 0 ? num_keys : ranks[k];
+    }
+
+    bool contains(T key) const {
+        size_t k = lower_bound_slot(key);
+        return k != 0 && keys[k] == key;
+    }
+
+    // lower_bound() of n queries
+    void lower_bound_batch(const T *queries, int n, int *positions) const;
+
+private:
+    // the levels starting from k + log2(PREFETCH_STRIDE) are in one cache line
+    static constexpr size_t PREFETCH_STRIDE = 64 / sizeof(T);
+
+    // slot of the first key not less than `key`, 0 if there is none
+    size_t lower_bound_slot(T key) const {
+        size_t k = 1;
+        while (k <= (size_t)num_keys) {
+            __builtin_prefetch(keys.data() + std::min(k * PREFETCH_STRIDE, (size_t)num_keys));
+            k = 2 * k + (keys[k] < key);
+        }
+        // undo the right turns taken after the last left turn
+        return k >> __builtin_ffsll(~k);
+    }
+
+    int num_keys = 0;
+    // the levels with every slot present
+    int full_levels = 0;
+    // keys and their sorted positions by slot, slot 0 is unused
+    std::vector<T> keys;
+    std::vector<int> ranks;
+};
+
+// Called by register_tasks() with the task id of the int index build task,
+// the other key types follow
+void register_search_tasks(Legion::TaskID base);
+
+} // namespace bitonic
+
+#endif // BITONIC_SEARCH_H
@@ -0,0 +1,249 @@
+// Inputs of many key files
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <glob.h>
+#include <sys/stat.h>
+#include "shards.h"
+#include "stats.h"
+
+using namespace Legion;
+
+namespace bitonic {
+
+static TaskID read_shard_task_id;
+static TaskID merge_task_base;
+
+template<typename T>
+static TaskID merge_task_id()
+{
+    return merge_task_base + KeyTraits<T>::type;
+}
+
+bool is_sharded_input(const char *input)
+{
+    return input[0] == '@' || strpbrk(input, "*?[") != NULL;
+}
+
+static void shard_error(const char *input, const char *what)
+{
+    fprintf(stderr, "%s: %s\n", input, what);
+    exit(1);
+}
+
+ShardSet find_shards(const char *input, size_t key_bytes)
+{
+    std::vector<std::string> paths;
+    if (input[0] == '@') {
+        std::string manifest = input + 1;
+        std::ifstream lines(manifest);
+        if (!lines) {
+            shard_error(manifest.c_str(), "cannot open the manifest");
+        }
+        size_t slash = manifest.rfind('/');
+        std::string dir = slash == std::string::npos ? "" : manifest.substr(0, slash + 1);
+        std::string line;
+        while (std::getline(lines, line)) {
+            // blank lines and comments
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            paths.push_back(line[0] == '/' ? line : dir + line);
+        }
+    } else {
+        // the matches come sorted by name
+        glob_t matches;
+        if (glob(input, 0, NULL, &matches) == 0) {
+            paths.assign(matches.gl_pathv, matches.gl_pathv + matches.gl_pathc);
+        }
+        globfree(&matches);
+    }
+
+    ShardSet shards;
+    for (const std::string &path : paths) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) {
+            shard_error(path.c_str(), "cannot stat the shard");
+        }
+        if (st.st_size % key_bytes != 0) {
+            shard_error(path.c_str(), "the shard is not a whole number of keys");
+        }
+        if (st.st_size == 0) {
+            continue;
+        }
+        shards.paths.push_back(path);
+        shards.starts.push_back(shards.num_keys() + st.st_size / key_bytes);
+    }
+    if (shards.size() == 0) {
+        shard_error(input, "no keys in the shards");
+    }
+    return shards;
+}
+
+// Read one shard into its piece, the local arguments hold its path
+void read_shard_task(const Task *task,
+                     const std::vector<PhysicalRegion> &regions,
+                     Context ctx, Runtime *runtime)
+{
+    TaskTimer timer(task);
+    assert(regions.size() == 1);
+    assert(task->arglen == sizeof(IoOptions));
+    auto io = (const IoOptions *)(task->args);
+    std::string path((const char *)task->local_args, task->local_arglen);
+    Rect<1> rect = runtime->get_index_space_domain(ctx,
+            task->regions[0].region.get_index_space());
+
+    assert(task->regions[0].privilege_fields.size() == 1);
+    FieldID fid = *task->regions[0].privilege_fields.begin();
+    size_t width = runtime->get_field_size(task->regions[0].region.get_field_space(), fid);
+    const FieldAccessor<WRITE_DISCARD, char, 1, coord_t, Realm::AffineAccessor<char, 1, coord_t>>
+        keys(regions[0], fid, width);
+    ChunkReader reader(path.c_str(), *io);
+    assert(reader.size() == width * rect.volume());
+    reader.read_all(keys.ptr(rect.lo));
+}
+
+// Merge the two sorted runs of the region in place, the local
+// arguments hold the first row of the second run
+template<typename T>
+void merge_runs_task(const Task *task,
+                     const std::vector<PhysicalRegion> &regions,
+                     Context ctx, Runtime *runtime)
+{
+    TaskTimer timer(task);
+    assert(regions.size() == 1);
+    assert(task->local_arglen == sizeof(long long));
+    long long mid = *(const long long *)task->local_args;
+    Rect<1> rect = runtime->get_index_space_domain(ctx,
+            task->regions[0].region.get_index_space());
+    assert(rect.lo[0] < mid && mid <= rect.hi[0]);
+
+    assert(task->regions[0].privilege_fields.size() == 1);
+    FieldID fid = *task->regions[0].privilege_fields.begin();
+    const FieldAccessor<READ_WRITE, T, 1, coord_t, Realm::AffineAccessor<T, 1, coord_t>>
+        keys(regions[0], fid);
+    T *a = keys.ptr(rect.lo);
+    std::inplace_merge(a, a + (mid - rect.lo[0]), a + rect.volume());
+}
+
+template<typename T>
+static void register_merge_task()
+{
+    TaskVariantRegistrar registrar(merge_task_id<T>(), "merge_runs");
+    registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+    registrar.set_leaf(true);
+    Runtime::preregister_task_variant<merge_runs_task<T>>(registrar, "merge_runs");
+}
+
+void register_shard_tasks(TaskID base)
+{
+    read_shard_task_id = base;
+    merge_task_base = base + 1;
+    {
+        TaskVariantRegistrar registrar(read_shard_task_id, "read_shard");
+        registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+        registrar.set_leaf(true);
+        Runtime::preregister_task_variant<read_shard_task>(registrar, "read_shard");
+    }
+    register_merge_task<int>();
+    register_merge_task<int16_t>();
+    register_merge_task<uint16_t>();
+    register_merge_task<uint8_t>();
+}
+
+LogicalPartition read_shards(Context ctx, Runtime *runtime, const ShardSet &shards,
+                             LogicalRegion region, FieldID fid, const IoOptions &io)
+{
+    Rect<1> rect = runtime->get_index_space_domain(ctx, region.get_index_space());
+    assert(rect.lo[0] == 0 && (long long)rect.volume() == shards.num_keys());
+
+    // a piece of the rows for each shard
+    std::map<DomainPoint, Domain> rows;
+    ArgumentMap paths;
+    for (size_t s = 0; s < shards.size(); s++) {
+        DomainPoint color = Point<1>(s);
+        rows[color] = Domain(Rect<1>(shards.starts[s], shards.starts[s + 1] - 1));
+        paths.set_point(color, TaskArgument(shards.paths[s].data(), shards.paths[s].size()));
+    }
+    IndexSpace colors = runtime->create_index_space(ctx, Rect<1>(0, shards.size() - 1));
+    IndexPartition ip = runtime->create_partition_by_domain(ctx, region.get_index_space(),
+                                                            rows, colors);
+    LogicalPartition pieces = runtime->get_logical_partition(ctx, region, ip);
+
+    IndexTaskLauncher reader(read_shard_task_id, colors, TaskArgument(&io, sizeof(io)), paths);
+    reader.add_region_requirement(RegionRequirement(pieces, 0, WRITE_DISCARD, EXCLUSIVE, region));
+    reader.region_requirements[0].add_field(fid);
+    runtime->execute_index_space(ctx, reader);
+    runtime->destroy_index_space(ctx, colors);
+    return pieces;
+}
+
+// Merge the sorted pieces pairwise in place, neighbours first. The
+// pairs of a level are disjoint, so each level is one index launch of a
+// merge task per pair, which waits on the merges of its two runs only.
+template<typename T>
+static void merge_pieces(Context ctx, Runtime *runtime, const ShardSet &shards,
+                         LogicalRegion region, FieldID fid)
+{
+    size_t n = shards.size();
+    for (size_t width = 1; width < n; width *= 2) {
+        std::map<DomainPoint, Domain> rows;
+        ArgumentMap mids;
+        size_t num_pairs = 0;
+        for (size_t lo = 0; lo + width < n; lo += 2 * width, num_pairs++) {
+            DomainPoint color = Point<1>(num_pairs);
+            rows[color] = Domain(Rect<1>(shards.starts[lo],
+                                         shards.starts[std::min(n, lo + 2 * width)] - 1));
+            mids.set_point(color, TaskArgument(&shards.starts[lo + width], sizeof(long long)));
+        }
+        IndexSpace colors = runtime->create_index_space(ctx, Rect<1>(0, num_pairs - 1));
+        IndexPartition ip = runtime->create_partition_by_domain(ctx, region.get_index_space(),
+                                                                rows, colors);
+        LogicalPartition pairs = runtime->get_logical_partition(ctx, region, ip);
+
+        IndexTaskLauncher merger(merge_task_id<T>(), colors, TaskArgument(), mids);
+        merger.add_region_requirement(RegionRequirement(pairs, 0, READ_WRITE, EXCLUSIVE, region));
+        merger.region_requirements[0].add_field(fid);
+        runtime->execute_index_space(ctx, merger);
+        // deleted once the merges are done
+        runtime->destroy_index_partition(ctx, ip);
+        runtime->destroy_index_space(ctx, colors);
+    }
+}
+
+void sort_shards(Context ctx, Runtime *runtime, const ShardSet &shards,
+                 LogicalRegion region, LogicalPartition pieces, FieldID fid,
+                 const SortOptions &options)
+{
+    // every sort waits only on the read of its own piece, the
+    // privileges come from the whole region
+    for (size_t s = 0; s < shards.size(); s++) {
+        LogicalRegion piece = runtime->get_logical_subregion_by_color(ctx, pieces,
+                                                                      DomainPoint(Point<1>(s)));
+        bitonic::sort(ctx, runtime, piece, fid, options, region);
+    }
+    if (shards.size() == 1) {
+        return;
+    }
+    switch (options.key_type) {
+    case KEY_INT16:
+        merge_pieces<int16_t>(ctx, runtime, shards, region, fid);
+        break;
+    case KEY_UINT16:
+        merge_pieces<uint16_t>(ctx, runtime, shards, region, fid);
+        break;
+    case KEY_UINT8:
+        merge_pieces<uint8_t>(ctx, runtime, shards, region, fid);
+        break;
+    default:
+        merge_pieces<int>(ctx, runtime, shards, region, fid);
+        break;
+    }
+}
+
+} // namespace bitonic
@@ -0,0 +1,59 @@
+// Inputs of many key files
+// An input given as a glob pattern, or as @manifest for a file listing
+// one path per line, names several files of raw keys. Their sizes are
+// taken up front, so every file gets its own piece of the input region
+// and one read task per file fills its piece, all in parallel. Each piece
+// is then sorted by itself, and as the sort of a piece only depends on
+// the read of that piece, its leaf sorts start as soon as the file is
+// loaded. The sorted pieces are merged pairwise by tasks, so the merges
+// of a level run in parallel, each as soon as its two runs are sorted.
+
+#ifndef BITONIC_SHARDS_H
+#define BITONIC_SHARDS_H
+
+#include <string>
+#include <vector>
+#include "bitonic.h"
+#include "io.h"
+
+namespace bitonic {
+
+struct ShardSet {
+    std::vector<std::string> paths;
+    // first key of each shard, followed by the number of keys
+    std::vector<long long> starts {0};
+
+    size_t size() const { return paths.size(); }
+    long long num_keys() const { return starts.back(); }
+};
+
+// True if `input` is a glob pattern or a @manifest
+bool is_sharded_input(const char *input);
+
+// The files of a sharded input in order, with their sizes in keys of
+// `key_bytes` bytes. Relative paths of a manifest are taken from the
+// directory of the manifest. Empty files are left out.
+ShardSet find_shards(const char *input, size_t key_bytes);
+
+// Register the read task with `base` and the merge tasks after it,
+// called by register_tasks()
+void register_shard_tasks(Legion::TaskID base);
+
+// Read every shard into its piece of `fid` of `region`, which has a row
+// per key of the shards. Returns the partition into the pieces, whose
+// reads are still running.
+Legion::LogicalPartition read_shards(Legion::Context ctx, Legion::Runtime *runtime,
+                                     const ShardSet &shards,
+                                     Legion::LogicalRegion region, Legion::FieldID fid,
+                                     const IoOptions &io = IoOptions());
+
+// Sort each piece of `pieces` and merge the sorted pieces, so that
+// `fid` of `region` is sorted. Returns once the tasks are launched.
+void sort_shards(Legion::Context ctx, Legion::Runtime *runtime,
+                 const ShardSet &shards, Legion::LogicalRegion region,
+                 Legion::LogicalPartition pieces, Legion::FieldID fid,
+                 const SortOptions &options = SortOptions());
+
+} // namespace bitonic
+
+#endif // BITONIC_SHARDS_H
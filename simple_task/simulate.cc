@@ -0,0 +1,267 @@
+// Cost simulation of the bitonic sorter
+// Keep the walk in sync with sort_keys() and subsorter_task() in bitonic.cc.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "simulate.h"
+#include "bitonic_kernels.h"
+
+namespace bitonic {
+
+static size_t key_size(KeyType key_type)
+{
+    switch (key_type) {
+    case KEY_INT16:
+        return sizeof(int16_t);
+    case KEY_UINT16:
+        return sizeof(uint16_t);
+    case KEY_UINT8:
+        return sizeof(uint8_t);
+    default:
+        return sizeof(int);
+    }
+}
+
+static int log2_of(long long n)
+{
+    int log = 0;
+    while ((1LL << log) < n) {
+        log++;
+    }
+    return log;
+}
+
+// compare-exchanges of kernels::bitonic_sort() on n keys
+static long long sort_comparators(long long n)
+{
+    long long log = log2_of(n);
+    return n / 2 * log * (log + 1) / 2;
+}
+
+template<typename T>
+static void calibrate(CostModel &model)
+{
+    const size_t num_keys = 1 << 16;
+    std::vector<T> keys(num_keys);
+    unsigned state = 1;
+    for (auto &key : keys) {
+        state = state * 1103515245 + 12345;
+        key = (T)(state >> 16);
+    }
+    auto start = std::chrono::steady_clock::now();
+    kernels::bitonic_sort(keys.data(), num_keys);
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    model.compare_ns = ns / sort_comparators(num_keys);
+
+    const size_t num_bytes = 64 << 20;
+    std::vector<char> src(num_bytes, 1), dst(num_bytes);
+    start = std::chrono::steady_clock::now();
+    memcpy(dst.data(), src.data(), num_bytes);
+    end = std::chrono::steady_clock::now();
+    ns = std::chrono::duration<double, std::nano>(end - start).count();
+    model.byte_ns = ns / num_bytes;
+}
+
+void calibrate_cost_model(CostModel &model, KeyType key_type)
+{
+    switch (key_type) {
+    case KEY_INT16:
+        calibrate<int16_t>(model);
+        break;
+    case KEY_UINT16:
+        calibrate<uint16_t>(model);
+        break;
+    case KEY_UINT8:
+        calibrate<uint8_t>(model);
+        break;
+    default:
+        calibrate<int>(model);
+        break;
+    }
+}
+
+long long estimate_peak_bytes(long long num_inputs, const SortOptions &options)
+{
+    const long long key = key_size(options.key_type);
+    const long long vec_header = sizeof(size_t);
+    auto in_region = [&](long long block) {
+        return (size_t)(key * block) >= options.region_threshold;
+    };
+    long long num_total = 1;
+    while (num_total < num_inputs) {
+        num_total <<= 1;
+    }
+    long long leaf_size = std::min((long long)options.leaf_size, num_total);
+
+    // the caller's keys, the padded copy and the leaf task arguments
+    long long bytes = key * num_inputs + 2 * key * num_total;
+    if (in_region(num_total / 2) || in_region(num_total)) {
+        bytes += 2 * key * num_total;
+    }
+    // the futures of a level are kept until the sort returns
+    for (long long block = leaf_size; block <= num_total; block <<= 1) {
+        bytes += num_total / block * vec_header;
+        if (!in_region(block)) {
+            bytes += key * num_total;
+        }
+    }
+    // the two inputs and the merged block of the final subsorter,
+    // and the swap futures it waits for at a time
+    bytes += 2 * key * num_total;
+    if (!options.stream_merge && num_total > leaf_size) {
+        bytes += num_total / 2 * (vec_header + 2 * key);
+    }
+    return bytes;
+}
+
+SimulationResult simulate(long long num_inputs, const SortOptions &options,
+                          const CostModel &model)
+{
+    SimulationResult result;
+    const long long key = key_size(options.key_type);
+    const long long vec_header = sizeof(size_t);
+    auto in_region = [&](long long block) {
+        return (size_t)(key * block) >= options.region_threshold;
+    };
+    // time of `count` independent tasks spread over the processors
+    auto parallel_us = [&](long long count, double task_us) {
+        long long waves = (count + model.num_procs - 1) / model.num_procs;
+        return waves * task_us;
+    };
+
+    long long num_total = 1;
+    while (num_total < num_inputs) {
+        num_total <<= 1;
+    }
+    result.num_inputs = num_inputs;
+    result.num_total = num_total;
+    // the sort_region task that runs the schedule
+    result.tasks += 1;
+    long long leaf_size = std::min((long long)options.leaf_size, num_total);
+
+    // min_max tasks of the compression pre-pass, the simulation
+    // keeps the key width since the key range is not known
+    if (options.compress) {
+        long long chunks = (num_inputs + options.leaf_size - 1) / options.leaf_size;
+        result.tasks += chunks;
+        result.arg_bytes += key * num_inputs;
+        result.future_bytes += chunks * 2 * sizeof(long long);
+        result.waits += chunks;
+        result.rounds += 1;
+        result.critical_path_us += model.task_us;
+        result.estimated_us += parallel_us(chunks, model.task_us);
+    }
+
+    // leaf level
+    long long num_leaves = num_total / leaf_size;
+    long long leaf_bytes = key * leaf_size;
+    result.tasks += num_leaves;
+    result.comparators += num_leaves * sort_comparators(leaf_size);
+    // the block index of the trace comes before the keys, recursive
+    // leaves in a region read their keys from there
+    if (!options.recursive || !in_region(leaf_size)) {
+        result.arg_bytes += num_leaves * (sizeof(int) + leaf_bytes);
+    }
+    // the final block is written to the output region
+    if (in_region(leaf_size) || leaf_size == num_total) {
+        result.region_bytes += num_leaves * leaf_bytes;
+        result.future_bytes += num_leaves * vec_header;
+    } else {
+        result.future_bytes += num_leaves * (vec_header + leaf_bytes);
+    }
+    double leaf_us = model.task_us
+        + sort_comparators(leaf_size) * model.compare_ns * 1e-3
+        + 2 * leaf_bytes * model.byte_ns * 1e-3;
+    result.critical_path_us += leaf_us;
+    result.estimated_us += parallel_us(num_leaves, leaf_us);
+
+    // merge levels, each subsorter waits for its inputs, then for the
+    // crosswork round and one round per gap larger than a leaf block
+    const long long swap_bytes = vec_header + 2 * key;
+    for (long long gap = leaf_size * 2; gap <= num_total; gap <<= 1) {
+        long long blocks = num_total / gap;
+        long long half = gap / 2;
+        long long block_bytes = key * gap;
+        long long swap_rounds = 1;
+        long long g = half;
+        for (; g > leaf_size; g /= 2) {
+            swap_rounds++;
+        }
+        long long fused = half * log2_of(g);
+        if (options.stream_merge) {
+            // no swap tasks, each vector of the block goes
+            // through one in-register merge network
+            long long lanes = std::max(64 / key, 1LL);
+            swap_rounds = 0;
+            fused = gap / 2 * log2_of(2 * lanes);
+        }
+
+        result.tasks += blocks * (1 + swap_rounds * half);
+        result.comparators += blocks * (swap_rounds * half + fused);
+        result.arg_bytes += blocks * swap_rounds * half * 2 * key;
+        // recursive sort tasks get the keys of their block,
+        // unless it is sorted in place in a region
+        if (options.recursive && !in_region(gap)) {
+            result.arg_bytes += blocks * block_bytes;
+        }
+        result.future_bytes += blocks * swap_rounds * half * swap_bytes;
+        result.waits += blocks * swap_rounds * half;
+        if (in_region(half)) {
+            result.region_bytes += blocks * block_bytes;
+        } else {
+            result.waits += blocks * 2;
+        }
+        if (in_region(gap) || gap == num_total) {
+            result.region_bytes += blocks * block_bytes;
+            result.future_bytes += blocks * vec_header;
+        } else {
+            result.future_bytes += blocks * (vec_header + block_bytes);
+        }
+        result.rounds += 1 + swap_rounds;
+
+        // subsorters of a level share the processors with their swaps
+        long long level_tasks = blocks * (1 + swap_rounds * half);
+        double level_us = parallel_us(level_tasks, model.task_us)
+            + blocks * fused * model.compare_ns * 1e-3 / model.num_procs
+            + blocks * 3 * block_bytes * model.byte_ns * 1e-3 / model.num_procs;
+        double span_us = (2 + swap_rounds) * model.task_us
+            + fused * model.compare_ns * 1e-3
+            + 3 * block_bytes * model.byte_ns * 1e-3;
+        result.critical_path_us += span_us;
+        result.estimated_us += std::max(level_us, span_us);
+    }
+
+    // the top-level task waits for the final block by mapping
+    // the output region, which does not copy it
+    result.waits += 1;
+    result.rounds += 1;
+    result.peak_bytes = estimate_peak_bytes(num_inputs, options);
+    return result;
+}
+
+void print_simulation(const SimulationResult &result, const SortOptions &options,
+                      const CostModel &model)
+{
+    printf("Simulated bitonic sorter for %lld keys (%lld padded), leaf %d, "
+           "region threshold %zu bytes\n",
+           result.num_inputs, result.num_total, options.leaf_size,
+           options.region_threshold);
+    printf("cost model: %.2f us/task, %.3f ns/compare, %.3f ns/byte, %d procs\n",
+           model.task_us, model.compare_ns, model.byte_ns, model.num_procs);
+    printf("tasks:            %lld\n", result.tasks);
+    printf("comparators:      %lld\n", result.comparators);
+    printf("argument bytes:   %lld\n", result.arg_bytes);
+    printf("future bytes:     %lld\n", result.future_bytes);
+    printf("region bytes:     %lld\n", result.region_bytes);
+    printf("blocking waits:   %lld\n", result.waits);
+    printf("sync rounds:      %lld\n", result.rounds);
+    printf("critical path:    %.3f ms\n", result.critical_path_us * 1e-3);
+    printf("estimated time:   %.3f ms\n", result.estimated_us * 1e-3);
+    printf("peak memory:      %.1f MiB\n", result.peak_bytes / (double)(1 << 20));
+}
+
+} // namespace bitonic
@@ -0,0 +1,57 @@
+// Cost simulation of the bitonic sorter
+// Walks the same schedule as sort_keys() and subsorter_task() without
+// launching tasks, and estimates the runtime from a per-task and
+// per-byte cost model, and the peak memory it takes.
+
+#ifndef BITONIC_SIMULATE_H
+#define BITONIC_SIMULATE_H
+
+#include "bitonic.h"
+
+namespace bitonic {
+
+struct CostModel {
+    // launch, scheduling and completion overhead of one task
+    double task_us = 20.0;
+    // one compare-exchange in a local kernel
+    double compare_ns = 1.0;
+    // one byte serialized, deserialized or copied
+    double byte_ns = 0.25;
+    // processors running tasks in parallel
+    int num_procs = 1;
+};
+
+struct SimulationResult {
+    long long num_inputs = 0;
+    long long num_total = 0;
+    long long tasks = 0;
+    long long comparators = 0;
+    // bytes of task arguments, futures and region blocks
+    long long arg_bytes = 0;
+    long long future_bytes = 0;
+    long long region_bytes = 0;
+    // blocking get_result calls, and the rounds of them on the critical path
+    long long waits = 0;
+    long long rounds = 0;
+    double critical_path_us = 0;
+    double estimated_us = 0;
+    long long peak_bytes = 0;
+};
+
+// Measure compare_ns and byte_ns on this host with the local kernels
+void calibrate_cost_model(CostModel &model, KeyType key_type);
+
+// Upper estimate of the memory taken by sorting num_inputs keys in
+// memory: the keys, their padded copy, the scratch regions, the futures
+// sort_keys() keeps for every level, and the blocks of the final merge
+long long estimate_peak_bytes(long long num_inputs, const SortOptions &options);
+
+SimulationResult simulate(long long num_inputs, const SortOptions &options,
+                          const CostModel &model);
+
+void print_simulation(const SimulationResult &result, const SortOptions &options,
+                      const CostModel &model);
+
+} // namespace bitonic
+
+#endif // BITONIC_SIMULATE_H
@@ -0,0 +1,274 @@
+// Files of sorted keys
+// A compressed block stores the deltas between consecutive keys, the first
+// one being 0, so a block decodes without the blocks before it.
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include "bitonic_kernels.h"
+#include "sorted_file.h"
+
+namespace bitonic {
+
+static size_t packed_words(size_t count, uint32_t bits)
+{
+    return (count * bits + 63) / 64;
+}
+
+template<typename T>
+size_t write_block(ChunkWriter &writer, const T *keys, size_t n, bool compress,
+                   std::vector<uint64_t> &packed)
+{
+    assert(n > 0 && n <= RUN_BLOCK_KEYS);
+    KeyBlockHeader header {(uint32_t)n, RAW_BLOCK, (int64_t)keys[0]};
+    if (!compress) {
+        writer.write(&header, sizeof(header));
+        writer.write(keys, sizeof(T) * n);
+        return sizeof(header) + sizeof(T) * n;
+    }
+    // keys are at most 32 bits wide, so are the deltas of sorted keys
+    uint32_t max_delta = 0;
+    for (size_t i = 1; i < n; i++) {
+        max_delta |= (uint32_t)((int64_t)keys[i] - (int64_t)keys[i-1]);
+    }
+    header.bits = max_delta == 0 ? 0 : 32 - __builtin_clz(max_delta);
+    packed.assign(packed_words(n, header.bits), 0);
+    for (size_t i = 1; i < n; i++) {
+        uint64_t delta = (uint32_t)((int64_t)keys[i] - (int64_t)keys[i-1]);
+        size_t bit = i * header.bits;
+        packed[bit / 64] |= delta << (bit % 64);
+        if (bit % 64 + header.bits > 64) {
+            packed[bit / 64 + 1] |= delta >> (64 - bit % 64);
+        }
+    }
+    writer.write(&header, sizeof(header));
+    writer.write(packed.data(), sizeof(uint64_t) * packed.size());
+    return sizeof(header) + sizeof(uint64_t) * packed.size();
+}
+
+template<typename T>
+size_t block_payload_bytes(const KeyBlockHeader &header)
+{
+    if (header.bits == RAW_BLOCK) {
+        return sizeof(T) * header.count;
+    }
+    assert(header.bits <= 32);
+    return sizeof(uint64_t) * packed_words(header.count, header.bits);
+}
+
+// Unpack 32-bit deltas and add them up, one register of deltas at a time.
+// The running sum is the key modulo 2^32, which is exact once it is
+// truncated to the key type.
+template<typename T>
+static void decode_deltas(const char *packed, size_t count, uint32_t bits,
+                          int64_t first, T *keys)
+{
+    typedef kernels::Simd<uint32_t> S;
+    const uint32_t mask = bits == 32 ? ~0u : (1u << bits) - 1;
+    // shift[k] moves lane i to lane i + 2^k and fills with zeros
+    S::index_vec shift[4];
+    for (int k = 0; k < 4; k++) {
+        for (size_t i = 0; i < S::lanes; i++) {
+            shift[k][i] = i >= (1u << k) ? i - (1u << k) : S::lanes;
+        }
+    }
+    const S::vec zero = {};
+    uint32_t base = (uint32_t)first;
+    uint32_t sums[S::lanes];
+    for (size_t i = 0; i < count; i += S::lanes) {
+        S::vec d;
+        for (size_t l = 0; l < S::lanes; l++) {
+            size_t bit = (i + l) * bits;
+            uint64_t word;
+            memcpy(&word, packed + bit / 8, sizeof(word));
+            d[l] = (uint32_t)(word >> (bit % 8)) & mask;
+        }
+        // inclusive prefix sum in log2(lanes) steps
+        for (int k = 0; (1u << k) < S::lanes; k++) {
+            d += __builtin_shuffle(d, zero, shift[k]);
+        }
+        d += base;
+        S::store(sums, d);
+        size_t n = std::min(S::lanes, count - i);
+        for (size_t l = 0; l < n; l++) {
+            keys[i + l] = (T)sums[l];
+        }
+        base = sums[S::lanes - 1];
+    }
+}
+
+template<typename T>
+void decode_block(const KeyBlockHeader &header, const char *payload, T *keys)
+{
+    if (header.bits == RAW_BLOCK) {
+        memcpy(keys, payload, sizeof(T) * header.count);
+    } else {
+        decode_deltas(payload, header.count, header.bits, header.first, keys);
+    }
+}
+
+template<typename T>
+SortedFileWriter<T>::SortedFileWriter(const char *path, const OutputOptions &options,
+                                      const IoOptions &io)
+    : options(options), writer(path, io), num_keys(0)
+{
+    block.reserve(RUN_BLOCK_KEYS);
+}
+
+template<typename T>
+void SortedFileWriter<T>::append(const T *keys, size_t n)
+{
+    if (!options.indexed) {
+        writer.write(keys, sizeof(T) * n);
+        num_keys += n;
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        block.push_back(keys[i]);
+        if (block.size() == RUN_BLOCK_KEYS) {
+            flush_block();
+        }
+    }
+}
+
+template<typename T>
+void SortedFileWriter<T>::flush_block()
+{
+    BlockIndexEntry entry {(int64_t)block.front(), (int64_t)block.back(),
+                           writer.size(), num_keys};
+    index.push_back(entry);
+    write_block(writer, block.data(), block.size(), options.compress, packed);
+    num_keys += block.size();
+    block.clear();
+}
+
+template<typename T>
+void SortedFileWriter<T>::finish()
+{
+    if (options.indexed) {
+        if (!block.empty()) {
+            flush_block();
+        }
+        SortedFileFooter footer;
+        memcpy(footer.magic, SORTED_FILE_MAGIC, sizeof(footer.magic));
+        footer.key_type = KeyTraits<T>::type;
+        footer.block_keys = RUN_BLOCK_KEYS;
+        footer.num_keys = num_keys;
+        footer.num_blocks = index.size();
+        footer.index_offset = writer.size();
+        writer.write(index.data(), sizeof(BlockIndexEntry) * index.size());
+        writer.write(&footer, sizeof(footer));
+    }
+    writer.finish();
+}
+
+static void pread_all(int fd, void *dst, size_t bytes, off_t offset)
+{
+    char *out = (char *)dst;
+    while (bytes > 0) {
+        ssize_t n = pread(fd, out, bytes, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        assert(n > 0);
+        out += n;
+        bytes -= n;
+        offset += n;
+    }
+}
+
+template<typename T>
+SortedFileReader<T>::SortedFileReader(const char *path)
+    : num_blocks_read(0)
+{
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        exit(1);
+    }
+    off_t size = lseek(fd, 0, SEEK_END);
+    assert(size >= (off_t)sizeof(footer));
+    pread_all(fd, &footer, sizeof(footer), size - sizeof(footer));
+    if (memcmp(footer.magic, SORTED_FILE_MAGIC, sizeof(footer.magic)) != 0) {
+        fprintf(stderr, "%s: not an indexed sorted file\n", path);
+        exit(1);
+    }
+    assert(footer.key_type == KeyTraits<T>::type);
+    assert(footer.block_keys <= RUN_BLOCK_KEYS);
+    index.resize(footer.num_blocks);
+    pread_all(fd, index.data(), sizeof(BlockIndexEntry) * index.size(), footer.index_offset);
+}
+
+template<typename T>
+SortedFileReader<T>::~SortedFileReader()
+{
+    close(fd);
+}
+
+template<typename T>
+void SortedFileReader<T>::read_block(size_t i, std::vector<T> &keys)
+{
+    assert(i < index.size());
+    uint64_t end = i + 1 < index.size() ? index[i+1].offset : footer.index_offset;
+    size_t bytes = end - index[i].offset;
+    payload.resize(bytes + BLOCK_DECODE_PADDING);
+    pread_all(fd, payload.data(), bytes, index[i].offset);
+    KeyBlockHeader header;
+    memcpy(&header, payload.data(), sizeof(header));
+    assert(sizeof(header) + block_payload_bytes<T>(header) == bytes);
+    keys.resize(header.count);
+    decode_block(header, payload.data() + sizeof(header), keys.data());
+    num_blocks_read++;
+}
+
+template<typename T>
+size_t SortedFileReader<T>::first_block(T key) const
+{
+    // blocks are in key order, so are their maxima
+    auto it = std::lower_bound(index.begin(), index.end(), (int64_t)key,
+            [](const BlockIndexEntry &entry, int64_t k) { return entry.max < k; });
+    return it - index.begin();
+}
+
+template<typename T>
+uint64_t SortedFileReader<T>::lower_bound(T key)
+{
+    size_t i = first_block(key);
+    if (i == index.size()) {
+        return footer.num_keys;
+    }
+    std::vector<T> keys;
+    read_block(i, keys);
+    return index[i].position + (std::lower_bound(keys.begin(), keys.end(), key) - keys.begin());
+}
+
+template size_t write_block<int>(ChunkWriter &, const int *, size_t, bool,
+        std::vector<uint64_t> &);
+template size_t block_payload_bytes<int>(const KeyBlockHeader &);
+template void decode_block<int>(const KeyBlockHeader &, const char *, int *);
+template size_t write_block<int16_t>(ChunkWriter &, const int16_t *, size_t, bool,
+        std::vector<uint64_t> &);
+template size_t block_payload_bytes<int16_t>(const KeyBlockHeader &);
+template void decode_block<int16_t>(const KeyBlockHeader &, const char *, int16_t *);
+template size_t write_block<uint16_t>(ChunkWriter &, const uint16_t *, size_t, bool,
+        std::vector<uint64_t> &);
+template size_t block_payload_bytes<uint16_t>(const KeyBlockHeader &);
+template void decode_block<uint16_t>(const KeyBlockHeader &, const char *, uint16_t *);
+template size_t write_block<uint8_t>(ChunkWriter &, const uint8_t *, size_t, bool,
+        std::vector<uint64_t> &);
+template size_t block_payload_bytes<uint8_t>(const KeyBlockHeader &);
+template void decode_block<uint8_t>(const KeyBlockHeader &, const char *, uint8_t *);
+
+template class SortedFileWriter<int>;
+template class SortedFileWriter<int16_t>;
+template class SortedFileWriter<uint16_t>;
+template class SortedFileWriter<uint8_t>;
+template class SortedFileReader<int>;
+template class SortedFileReader<int16_t>;
+template class SortedFileReader<uint16_t>;
+template class SortedFileReader<uint8_t>;
+
+} // namespace bitonic
@@ -0,0 +1,145 @@
+// Files of sorted keys
+// Sorted keys are stored in blocks of at most RUN_BLOCK_KEYS keys. Each
+// block starts with a KeyBlockHeader and is followed either by the keys
+// themselves or, when compressed, by the deltas between consecutive keys
+// bit-packed with the width of the largest one. Spill runs of the external
+// sort are plain sequences of blocks. Indexed output files add an index
+// with the key range and offset of each block and a footer, so readers can
+// binary-search and range-scan them without reading the whole file.
+
+#ifndef BITONIC_SORTED_FILE_H
+#define BITONIC_SORTED_FILE_H
+
+#include <memory>
+#include <vector>
+#include "bitonic.h"
+#include "io.h"
+
+namespace bitonic {
+
+// Keys per block
+const int RUN_BLOCK_KEYS = 1024;
+
+// bits of a block stored without compression
+const uint32_t RAW_BLOCK = ~0u;
+
+struct KeyBlockHeader {
+    uint32_t count;
+    // bits per delta, or RAW_BLOCK
+    uint32_t bits;
+    int64_t first;
+};
+
+// Bytes the block decoder may read past the end of a payload
+const size_t BLOCK_DECODE_PADDING = 72;
+
+// Append the sorted keys as one block, returns the bytes written
+template<typename T>
+size_t write_block(ChunkWriter &writer, const T *keys, size_t n, bool compress,
+                   std::vector<uint64_t> &packed);
+
+// Bytes of the payload after a block header
+template<typename T>
+size_t block_payload_bytes(const KeyBlockHeader &header);
+
+// Decode the payload of a block, which must be followed by
+// BLOCK_DECODE_PADDING readable bytes
+template<typename T>
+void decode_block(const KeyBlockHeader &header, const char *payload, T *keys);
+
+struct OutputOptions {
+    // write the block format with an index instead of raw keys
+    bool indexed = false;
+    // delta-encode the blocks of indexed files
+    bool compress = false;
+};
+
+const char SORTED_FILE_MAGIC[8] = {'B', 'I', 'T', 'O', 'N', 'I', 'C', '1'};
+
+struct BlockIndexEntry {
+    int64_t min;
+    int64_t max;
+    // file offset of the block header, and position of its first key
+    uint64_t offset;
+    uint64_t position;
+};
+
+// The last bytes of an indexed file
+struct SortedFileFooter {
+    char magic[8];
+    uint32_t key_type;
+    uint32_t block_keys;
+    uint64_t num_keys;
+    uint64_t num_blocks;
+    uint64_t index_offset;
+};
+
+// Writes sorted keys as raw keys or as an indexed file
+template<typename T>
+class SortedFileWriter {
+public:
+    SortedFileWriter(const char *path, const OutputOptions &options,
+                     const IoOptions &io = IoOptions());
+
+    void append(const T *keys, size_t n);
+    // write the last block and the index
+    void finish();
+
+    size_t file_bytes() const { return writer.size(); }
+
+private:
+    void flush_block();
+
+    OutputOptions options;
+    ChunkWriter writer;
+    std::vector<T> block;
+    std::vector<uint64_t> packed;
+    std::vector<BlockIndexEntry> index;
+    uint64_t num_keys;
+};
+
+// Random access to the blocks of an indexed file
+template<typename T>
+class SortedFileReader {
+public:
+    SortedFileReader(const char *path);
+    ~SortedFileReader();
+
+    uint64_t size() const { return footer.num_keys; }
+    const std::vector<BlockIndexEntry> &block_index() const { return index; }
+    // blocks read since the file was opened
+    size_t blocks_read() const { return num_blocks_read; }
+
+    void read_block(size_t i, std::vector<T> &keys);
+
+    // position of the first key not less than `key`
+    uint64_t lower_bound(T key);
+
+    // pass the keys in [lo, hi] to f(const T *keys, size_t n), block by block
+    template<typename F>
+    void scan(T lo, T hi, F f) {
+        std::vector<T> keys;
+        for (size_t i = first_block(lo); i < index.size() && index[i].min <= hi; i++) {
+            read_block(i, keys);
+            auto begin = std::lower_bound(keys.begin(), keys.end(), lo);
+            auto end = std::upper_bound(begin, keys.end(), hi);
+            if (begin != end) {
+                f(&*begin, end - begin);
+            }
+        }
+    }
+
+private:
+    // the first block that may hold keys not less than `key`
+    size_t first_block(T key) const;
+
+    int fd;
+    SortedFileFooter footer;
+    std::vector<BlockIndexEntry> index;
+    std::vector<char> payload;
+    size_t num_blocks_read;
+};
+
+} // namespace bitonic
+
+#endif // BITONIC_SORTED_FILE_H
@@ -0,0 +1,249 @@
+// Per-processor utilization and per-stage bandwidth of the sorter tasks
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "stats.h"
+
+using namespace Legion;
+
+namespace bitonic {
+
+struct ProcStats {
+    long long tasks = 0;
+    double busy_us = 0;
+    double blocked_us = 0;
+};
+
+static std::atomic<bool> enabled(false);
+static std::mutex stats_mutex;
+static std::map<Processor, ProcStats> proc_stats;
+static std::chrono::steady_clock::time_point wall_start;
+// the timer of each running task by its context. Tasks run as user-level
+// threads, so while one task waits another may run on the same kernel
+// thread, and the timers cannot be kept per thread.
+static std::map<Context, TaskTimer *> task_timers;
+
+static double elapsed_us(std::chrono::steady_clock::time_point start)
+{
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+void enable_utilization(bool enable)
+{
+    std::lock_guard<std::mutex> guard(stats_mutex);
+    proc_stats.clear();
+    wall_start = std::chrono::steady_clock::now();
+    enabled = enable;
+}
+
+bool utilization_enabled()
+{
+    return enabled;
+}
+
+TaskTimer::TaskTimer(const Task *task)
+    : trace(task->get_task_name(), "task"), active(enabled),
+      proc(task->current_proc), blocked_us(0), ctx(NULL), outer(NULL)
+{
+    trace.set_proc(proc.id);
+    if (active) {
+        start = std::chrono::steady_clock::now();
+        ctx = Runtime::get_context();
+        std::lock_guard<std::mutex> guard(stats_mutex);
+        TaskTimer *&current = task_timers[ctx];
+        outer = current;
+        current = this;
+    }
+}
+
+TaskTimer::~TaskTimer()
+{
+    if (!active) {
+        return;
+    }
+    double total_us = elapsed_us(start);
+    std::lock_guard<std::mutex> guard(stats_mutex);
+    if (outer != NULL) {
+        task_timers[ctx] = outer;
+    } else {
+        task_timers.erase(ctx);
+    }
+    ProcStats &stats = proc_stats[proc];
+    stats.tasks++;
+    stats.busy_us += total_us - blocked_us;
+    stats.blocked_us += blocked_us;
+}
+
+BlockedTimer::BlockedTimer()
+    : timer(NULL)
+{
+    if (!enabled) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(stats_mutex);
+        auto it = task_timers.find(Runtime::get_context());
+        if (it != task_timers.end()) {
+            timer = it->second;
+        }
+    }
+    if (timer != NULL) {
+        start = std::chrono::steady_clock::now();
+    }
+}
+
+BlockedTimer::~BlockedTimer()
+{
+    if (timer != NULL) {
+        timer->add_blocked(elapsed_us(start));
+    }
+}
+
+void print_utilization()
+{
+    std::lock_guard<std::mutex> guard(stats_mutex);
+    double wall_us = elapsed_us(wall_start);
+
+    // include processors that never ran a sorter task
+    Machine::ProcessorQuery procs(Machine::get_machine());
+    procs.only_kind(Processor::LOC_PROC).local_address_space();
+    for (Processor proc : procs) {
+        proc_stats[proc];
+    }
+
+    printf("processor utilization over %.3f ms:\n", wall_us * 1e-3);
+    printf("%-20s %10s %12s %12s %12s %8s\n",
+           "processor", "tasks", "busy ms", "blocked ms", "idle ms", "busy %");
+    double max_busy = 0, sum_busy = 0;
+    for (const auto &entry : proc_stats) {
+        const ProcStats &stats = entry.second;
+        double idle_us = std::max(0.0, wall_us - stats.busy_us);
+        printf("%-20llx %10lld %12.3f %12.3f %12.3f %7.1f%%\n",
+               (unsigned long long)entry.first.id, stats.tasks,
+               stats.busy_us * 1e-3, stats.blocked_us * 1e-3, idle_us * 1e-3,
+               wall_us > 0 ? 100 * stats.busy_us / wall_us : 0);
+        max_busy = std::max(max_busy, stats.busy_us);
+        sum_busy += stats.busy_us;
+    }
+    if (!proc_stats.empty() && sum_busy > 0) {
+        double mean_busy = sum_busy / proc_stats.size();
+        printf("load imbalance (max / mean busy time): %.3f\n", max_busy / mean_busy);
+    }
+}
+
+struct StageStats {
+    std::atomic<long long> calls {0};
+    std::atomic<long long> bytes {0};
+    std::atomic<long long> ns {0};
+};
+
+static const char *stage_names[NUM_STAGES] = {
+    "leaf", "crosswork", "large-gap", "fused small-gap", "stream merge",
+};
+
+static std::atomic<bool> roofline(false);
+static StageStats stage_stats[NUM_STAGES];
+// STREAM triad bandwidth of one core and of all cores, in GB/s
+static double peak_core_gbs = 0;
+static double peak_node_gbs = 0;
+
+// Best triad bandwidth of `num_threads` threads over a few runs,
+// each thread works on arrays larger than the last level cache
+static double stream_triad(int num_threads)
+{
+    const size_t num_elems = 4 << 20;
+    std::vector<std::vector<double>> a(num_threads), b(num_threads), c(num_threads);
+    for (int t = 0; t < num_threads; t++) {
+        a[t].assign(num_elems, 0.0);
+        b[t].assign(num_elems, 1.0);
+        c[t].assign(num_elems, 2.0);
+    }
+    double best_gbs = 0;
+    for (int run = 0; run < 3; run++) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (int t = 0; t < num_threads; t++) {
+            threads.emplace_back([&, t]() {
+                double *x = a[t].data();
+                const double *y = b[t].data(), *z = c[t].data();
+                for (size_t i = 0; i < num_elems; i++) {
+                    x[i] = y[i] + 3.0 * z[i];
+                }
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        double seconds = elapsed_us(start) * 1e-6;
+        // triad reads two arrays and writes one
+        double bytes = 3.0 * sizeof(double) * num_elems * num_threads;
+        best_gbs = std::max(best_gbs, bytes / seconds * 1e-9);
+    }
+    return best_gbs;
+}
+
+void enable_roofline(bool enable)
+{
+    if (enable) {
+        peak_core_gbs = stream_triad(1);
+        peak_node_gbs = stream_triad(std::max(1u, std::thread::hardware_concurrency()));
+    }
+    for (auto &stats : stage_stats) {
+        stats.calls = 0;
+        stats.bytes = 0;
+        stats.ns = 0;
+    }
+    roofline = enable;
+}
+
+bool roofline_enabled()
+{
+    return roofline;
+}
+
+StageTimer::StageTimer(Stage stage, size_t bytes)
+    : trace(stage_names[stage], "stage"), active(roofline), stage(stage), bytes(bytes)
+{
+    if (active) {
+        start = std::chrono::steady_clock::now();
+    }
+}
+
+void StageTimer::stop()
+{
+    trace.end();
+    if (!active) {
+        return;
+    }
+    active = false;
+    StageStats &stats = stage_stats[stage];
+    stats.calls++;
+    stats.bytes += bytes;
+    stats.ns += (long long)(elapsed_us(start) * 1e3);
+}
+
+void print_roofline()
+{
+    printf("memory bandwidth peak (STREAM triad): %.2f GB/s per core, "
+           "%.2f GB/s all cores\n", peak_core_gbs, peak_node_gbs);
+    printf("%-16s %10s %14s %12s %10s %10s\n",
+           "stage", "calls", "bytes", "time ms", "GB/s", "% core");
+    for (int i = 0; i < NUM_STAGES; i++) {
+        const StageStats &stats = stage_stats[i];
+        // stages run one per task, so their bandwidth
+        // is compared against the peak of one core
+        double seconds = stats.ns * 1e-9;
+        double gbs = seconds > 0 ? stats.bytes / seconds * 1e-9 : 0;
+        printf("%-16s %10lld %14lld %12.3f %10.2f %9.1f%%\n",
+               stage_names[i], (long long)stats.calls, (long long)stats.bytes,
+               seconds * 1e3, gbs, peak_core_gbs > 0 ? 100 * gbs / peak_core_gbs : 0);
+    }
+}
+
+} // namespace bitonic
@@ -0,0 +1,106 @@
+// Per-processor utilization and per-stage bandwidth of the sorter tasks
+// Collects busy time, tasks executed and time blocked in get_result()
+// for each processor of this process, and the bytes and time of each
+// kind of bitonic stage, when enabled.
+
+#ifndef BITONIC_STATS_H
+#define BITONIC_STATS_H
+
+#include <chrono>
+#include "legion.h"
+#include "trace.h"
+
+namespace bitonic {
+
+// Enabling also restarts the wall clock that idle time is measured against
+void enable_utilization(bool enable);
+bool utilization_enabled();
+
+// Print per-processor busy, blocked and idle time and the load imbalance
+void print_utilization();
+
+// Times a task body on its processor, declare one at the top of each task.
+// Time spent in BlockedTimer scopes of the task is not counted as busy.
+// The task is also recorded in the trace when tracing is enabled.
+class TaskTimer {
+public:
+    TaskTimer(const Legion::Task *task);
+    ~TaskTimer();
+
+    void add_blocked(double us) { blocked_us += us; }
+    // merge level and block of the task, for the trace
+    void annotate(int level, int block) { trace.annotate(level, block); }
+
+private:
+    TraceScope trace;
+    bool active;
+    Legion::Processor proc;
+    std::chrono::steady_clock::time_point start;
+    double blocked_us;
+    // the context of the task, and the timer it replaced there
+    Legion::Context ctx;
+    TaskTimer *outer;
+};
+
+// Accounts a blocking wait to the enclosing task's processor
+class BlockedTimer {
+public:
+    BlockedTimer();
+    ~BlockedTimer();
+
+private:
+    // the timer of the waiting task, NULL when not timed
+    TaskTimer *timer;
+    std::chrono::steady_clock::time_point start;
+};
+
+enum Stage {
+    STAGE_LEAF,
+    STAGE_CROSSWORK,
+    STAGE_LARGE_GAP,
+    STAGE_FUSED_SMALL_GAP,
+    STAGE_STREAM_MERGE,
+    NUM_STAGES,
+};
+
+// Run a STREAM-like copy and triad benchmark on one and on all cores,
+// and start collecting the bandwidth of each stage
+void enable_roofline(bool enable);
+bool roofline_enabled();
+
+// Print the achieved bandwidth of each stage against the measured peak
+void print_roofline();
+
+// Times one stage that moves `bytes` bytes of keys in and out of memory,
+// until stop() or the end of the scope
+class StageTimer {
+public:
+    StageTimer(Stage stage, size_t bytes);
+    ~StageTimer() { stop(); }
+
+    void stop();
+
+private:
+    TraceScope trace;
+    bool active;
+    Stage stage;
+    size_t bytes;
+    std::chrono::steady_clock::time_point start;
+};
+
+template<typename T>
+T timed_get_result(const Legion::Future &future)
+{
+    BlockedTimer timer;
+    return future.template get_result<T>();
+}
+
+inline void timed_wait(const Legion::Future &future)
+{
+    BlockedTimer timer;
+    future.get_void_result();
+}
+
+} // namespace bitonic
+
+#endif // BITONIC_STATS_H
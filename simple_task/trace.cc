@@ -0,0 +1,123 @@
+// Timeline of the sorter tasks in the Chrome trace_event format
+
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "trace.h"
+
+namespace bitonic {
+
+std::atomic<bool> tracing(false);
+
+struct TraceEvent {
+    const char *name;
+    const char *category;
+    std::chrono::steady_clock::time_point begin;
+    std::chrono::steady_clock::time_point end;
+    int level;
+    int block;
+    unsigned long long proc;
+};
+
+// Events of one thread, the slot of event i is i % TRACE_RING_EVENTS
+struct TraceRing {
+    int tid;
+    size_t recorded = 0;
+    std::vector<TraceEvent> events;
+};
+
+static std::mutex trace_mutex;
+static std::string trace_path;
+static std::chrono::steady_clock::time_point trace_start;
+// rings outlive their threads, so the events of finished threads are kept
+static std::vector<TraceRing *> rings;
+static thread_local TraceRing *thread_ring = NULL;
+
+void enable_trace(const char *path)
+{
+    std::lock_guard<std::mutex> guard(trace_mutex);
+    static bool registered = false;
+    if (!registered) {
+        atexit(write_trace);
+        registered = true;
+    }
+    trace_path = path;
+    trace_start = std::chrono::steady_clock::now();
+    tracing = true;
+}
+
+void TraceScope::record()
+{
+    if (thread_ring == NULL) {
+        std::lock_guard<std::mutex> guard(trace_mutex);
+        thread_ring = new TraceRing();
+        thread_ring->tid = rings.size();
+        thread_ring->events.resize(TRACE_RING_EVENTS);
+        rings.push_back(thread_ring);
+    }
+    TraceEvent &event = thread_ring->events[thread_ring->recorded % TRACE_RING_EVENTS];
+    event = TraceEvent {name, category, begin, std::chrono::steady_clock::now(),
+                        level, block, proc};
+    thread_ring->recorded++;
+}
+
+static double trace_us(std::chrono::steady_clock::time_point t)
+{
+    return std::chrono::duration<double, std::micro>(t - trace_start).count();
+}
+
+void write_trace()
+{
+    if (!tracing.exchange(false)) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(trace_mutex);
+    FILE *file = fopen(trace_path.c_str(), "w");
+    if (file == NULL) {
+        perror(trace_path.c_str());
+        return;
+    }
+    fprintf(file, "{\"traceEvents\": [\n");
+    bool first = true;
+    long long dropped = 0;
+    for (TraceRing *ring : rings) {
+        size_t begin = 0;
+        if (ring->recorded > TRACE_RING_EVENTS) {
+            begin = ring->recorded - TRACE_RING_EVENTS;
+            dropped += begin;
+        }
+        for (size_t i = begin; i < ring->recorded; i++) {
+            const TraceEvent &event = ring->events[i % TRACE_RING_EVENTS];
+            fprintf(file, "%s{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", "
+                    "\"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %d, \"args\": {",
+                    first ? "" : ",\n", event.name, event.category,
+                    trace_us(event.begin), trace_us(event.end) - trace_us(event.begin),
+                    (int)getpid(), ring->tid);
+            const char *sep = "";
+            if (event.proc != 0) {
+                fprintf(file, "\"proc\": \"%llx\"", event.proc);
+                sep = ", ";
+            }
+            if (event.level >= 0) {
+                fprintf(file, "%s\"level\": %d", sep, event.level);
+                sep = ", ";
+            }
+            if (event.block >= 0) {
+                fprintf(file, "%s\"block\": %d", sep, event.block);
+            }
+            fprintf(file, "}}");
+            first = false;
+        }
+        ring->recorded = 0;
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    if (dropped > 0) {
+        fprintf(stderr, "trace: dropped the %lld oldest events of full ring buffers\n", dropped);
+    }
+}
+
+} // namespace bitonic
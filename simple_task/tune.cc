@@ -0,0 +1,240 @@
+// Auto-tuning of the sort options
+// The profile is a text file with one line per host and key type:
+// cpu model, cores, key type, leaf size, region threshold and stream
+// merge, separated by tabs.
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "simulate.h"
+#include "tune.h"
+
+using namespace Legion;
+
+namespace bitonic {
+
+static const int TUNE_LEAF_SIZES[] = {256, 1024, 4096, 16384};
+static const size_t TUNE_REGION_THRESHOLDS[] = {64 << 10, 1 << 20, 16 << 20};
+// sorts per candidate, the fastest one counts
+static const int TUNE_REPEATS = 2;
+// simulated time of one sort of the sample, longer candidates are skipped
+static const double TUNE_BUDGET_US = 2e6;
+// smallest sample the budget can shrink it to
+static const long long TUNE_MIN_KEYS = 1 << 16;
+
+static const char *key_type_name(KeyType key_type)
+{
+    switch (key_type) {
+    case KEY_INT16:
+        return KeyTraits<int16_t>::name;
+    case KEY_UINT16:
+        return KeyTraits<uint16_t>::name;
+    case KEY_UINT8:
+        return KeyTraits<uint8_t>::name;
+    default:
+        return KeyTraits<int>::name;
+    }
+}
+
+std::string host_signature()
+{
+    std::string model = "unknown";
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line)) {
+        if (line.compare(0, 10, "model name") == 0) {
+            size_t colon = line.find(':');
+            if (colon != std::string::npos && colon + 2 <= line.size()) {
+                model = line.substr(colon + 2);
+            }
+            break;
+        }
+    }
+    std::replace(model.begin(), model.end(), '\t', ' ');
+    return model + "\t" + std::to_string(std::thread::hardware_concurrency());
+}
+
+std::string default_tune_profile()
+{
+    const char *home = getenv("HOME");
+    return std::string(home != NULL ? home : ".") + "/.bitonic_tune";
+}
+
+static std::string profile_key(KeyType key_type)
+{
+    return host_signature() + "\t" + key_type_name(key_type) + "\t";
+}
+
+bool load_tuning(const char *path, SortOptions &options)
+{
+    std::ifstream file(path);
+    const std::string key = profile_key(options.key_type);
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.compare(0, key.size(), key) != 0) {
+            continue;
+        }
+        std::istringstream fields(line.substr(key.size()));
+        int leaf_size, stream_merge;
+        size_t region_threshold;
+        if (!(fields >> leaf_size >> region_threshold >> stream_merge)) {
+            fprintf(stderr, "%s: ignoring a malformed entry\n", path);
+            return false;
+        }
+        options.leaf_size = leaf_size;
+        options.region_threshold = region_threshold;
+        options.stream_merge = stream_merge != 0;
+        return true;
+    }
+    return false;
+}
+
+void save_tuning(const char *path, const SortOptions &options)
+{
+    const std::string key = profile_key(options.key_type);
+    std::vector<std::string> lines;
+    {
+        std::ifstream file(path);
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.compare(0, key.size(), key) != 0) {
+                lines.push_back(line);
+            }
+        }
+    }
+    std::ostringstream entry;
+    entry << key << options.leaf_size << "\t" << options.region_threshold
+          << "\t" << (int)options.stream_merge;
+    lines.push_back(entry.str());
+
+    // concurrent jobs see either the old or the new profile
+    std::string tmp = std::string(path) + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream file(tmp);
+        for (auto &line : lines) {
+            file << line << "\n";
+        }
+        if (!file) {
+            perror(tmp.c_str());
+            return;
+        }
+    }
+    if (rename(tmp.c_str(), path) != 0) {
+        perror(path);
+        remove(tmp.c_str());
+    }
+}
+
+template<typename T>
+static double time_sort(Context ctx, Runtime *runtime, const std::vector<T> &keys,
+                        const SortOptions &options)
+{
+    double best_ms = 0;
+    for (int i = 0; i < TUNE_REPEATS; i++) {
+        auto start = std::chrono::steady_clock::now();
+        sort_values<T>(ctx, runtime, keys, options);
+        auto end = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(end - start).count();
+        best_ms = i == 0 ? ms : std::min(best_ms, ms);
+    }
+    return best_ms;
+}
+
+template<typename T>
+static SortOptions tune(Context ctx, Runtime *runtime, SortOptions best,
+                        long long sample_keys)
+{
+    // the swap engine takes a task per compare-exchange of blocks, so
+    // the search starts from the stream merge, and the simulated sort
+    // keeps every timed sort within the budget
+    best.stream_merge = true;
+    CostModel model;
+    Machine::ProcessorQuery procs(Machine::get_machine());
+    procs.only_kind(Processor::LOC_PROC).local_address_space();
+    model.num_procs = std::max<int>(procs.count(), 1);
+    calibrate_cost_model(model, best.key_type);
+    auto estimate_us = [&](const SortOptions &candidate) {
+        return simulate(sample_keys, candidate, model).estimated_us;
+    };
+    while (sample_keys > TUNE_MIN_KEYS && estimate_us(best) > TUNE_BUDGET_US) {
+        sample_keys /= 2;
+    }
+    debug("tune: %lld keys per sort\n", sample_keys);
+
+    std::vector<T> keys(sample_keys);
+    std::mt19937_64 rng(1);
+    for (auto &key : keys) {
+        key = (T)rng();
+    }
+    double best_ms = time_sort(ctx, runtime, keys, best);
+    auto try_options = [&](const SortOptions &candidate) {
+        if (estimate_us(candidate) > TUNE_BUDGET_US) {
+            debug("tune: leaf %d, region threshold %zu, stream merge %d: skipped\n",
+                  candidate.leaf_size, candidate.region_threshold,
+                  (int)candidate.stream_merge);
+            return;
+        }
+        double ms = time_sort(ctx, runtime, keys, candidate);
+        debug("tune: leaf %d, region threshold %zu, stream merge %d: %.3f ms\n",
+              candidate.leaf_size, candidate.region_threshold,
+              (int)candidate.stream_merge, ms);
+        if (ms < best_ms) {
+            best_ms = ms;
+            best = candidate;
+        }
+    };
+
+    // the merge kernel changes the cost of every level, so it goes first
+    SortOptions base = best;
+    base.stream_merge = !base.stream_merge;
+    try_options(base);
+    base = best;
+    for (int leaf_size : TUNE_LEAF_SIZES) {
+        if (leaf_size != base.leaf_size) {
+            SortOptions candidate = base;
+            candidate.leaf_size = leaf_size;
+            try_options(candidate);
+        }
+    }
+    base = best;
+    for (size_t region_threshold : TUNE_REGION_THRESHOLDS) {
+        if (region_threshold != base.region_threshold) {
+            SortOptions candidate = base;
+            candidate.region_threshold = region_threshold;
+            try_options(candidate);
+        }
+    }
+    return best;
+}
+
+SortOptions tune_sort_options(Context ctx, Runtime *runtime,
+                              const SortOptions &options, long long sample_keys)
+{
+    assert(sample_keys > 0);
+    switch (options.key_type) {
+    case KEY_INT16:
+        return tune<int16_t>(ctx, runtime, options, sample_keys);
+    case KEY_UINT16:
+        return tune<uint16_t>(ctx, runtime, options, sample_keys);
+    case KEY_UINT8:
+        return tune<uint8_t>(ctx, runtime, options, sample_keys);
+    default:
+        return tune<int>(ctx, runtime, options, sample_keys);
+    }
+}
+
+void print_tuning(const SortOptions &options)
+{
+    printf("tuning for %s keys: leaf %d, region threshold %zu, stream merge %s\n",
+           key_type_name(options.key_type), options.leaf_size,
+           options.region_threshold, options.stream_merge ? "on" : "off");
+}
+
+} // namespace bitonic
@@ -0,0 +1,44 @@
+// Auto-tuning of the sort options
+// A calibration run times sorts of a random sample with candidate leaf
+// sizes, region thresholds and merge kernels, and keeps the fastest. The
+// result is saved in a profile file under the CPU model, the core count
+// and the key type, so later runs on the same host load it instead of
+// calibrating again.
+
+#ifndef BITONIC_TUNE_H
+#define BITONIC_TUNE_H
+
+#include <string>
+#include "bitonic.h"
+
+namespace bitonic {
+
+// Keys sorted by each calibration run
+const long long DEFAULT_TUNE_KEYS = 1 << 20;
+
+// Host part of the profile key, "<cpu model>\t<cores>"
+std::string host_signature();
+
+// Default profile path, $HOME/.bitonic_tune
+std::string default_tune_profile();
+
+// Set the tuned fields of `options` from the entry of this host and
+// options.key_type, false if the profile has no such entry
+bool load_tuning(const char *path, SortOptions &options);
+
+// Add or replace the entry of this host and options.key_type
+void save_tuning(const char *path, const SortOptions &options);
+
+// Calibrate the leaf size, region threshold and merge kernel one at a
+// time on up to `sample_keys` random keys, starting from `options` with
+// the stream merge. The sample is halved until the simulated sort fits
+// the time budget, and candidates simulated to take longer are skipped.
+SortOptions tune_sort_options(Legion::Context ctx, Legion::Runtime *runtime,
+                              const SortOptions &options,
+                              long long sample_keys = DEFAULT_TUNE_KEYS);
+
+void print_tuning(const SortOptions &options);
+
+} // namespace bitonic
+
+#endif // BITONIC_TUNE_H